@@ -166,6 +166,11 @@ void accel_set_func(glui32 index, glui32 addr)
 
     ptr->index = index;
     ptr->func = new_func;
+
+#ifdef CALL_CACHE
+    /* Cached call sites may have the old acceleration status. */
+    flush_call_cache();
+#endif /* CALL_CACHE */
 }
 
 void accel_set_param(glui32 index, glui32 val)
@@ -211,6 +216,7 @@ static void accel_error(char *msg)
     glui32 mode, rock;
     stream_get_iosys(&mode, &rock);
     if (mode == 2) { /* iosys_Glk */
+        stream_flush();
         glk_put_char('\n');
         glk_put_string(msg);
         glk_put_char('\n');
@@ -0,0 +1,153 @@
+/* aot.c: Glulxe code for running a precompiled story.
+    Designed by Andrew Plotkin <erkyrath@eblong.com>
+    http://eblong.com/zarf/glulx/index.html
+*/
+
+#include "glk.h"
+#include "glulxe.h"
+
+#ifdef PRECOMPILED_STORY
+
+/* A precompiled story is a C file generated by "glulxdump -c", which
+   contains one C function for each function in the game file's ROM.
+   (See dump_c() in glulxdump.c.) It is compiled and linked into the
+   interpreter. If the game that's loaded has the same checksum as the
+   one that was translated, we run the translated code wherever we can.
+
+   A translated function is called with the address of an instruction
+   inside it. If the function can be entered there -- the start of the
+   function, a branch target, or the instruction after one that the
+   translator couldn't handle -- it runs from that point, and returns
+   the address of the next instruction for the interpreter to execute.
+   Otherwise it returns zero, and nothing has happened.
+
+   The interpreter tries translated code at the same places that it
+   would try the JIT: function entry and backward branches. It also
+   tries after returning from a function, and after executing any
+   instruction that translated code stopped at.
+*/
+
+/* The number of entries in the lookup cache. This must be a power of
+   two. */
+#define AOT_CACHE_SIZE (2048)
+/* The most times we enter translated code in a row without returning
+   to the interpreter. */
+#define AOT_CHAIN_LIMIT (64)
+
+typedef struct aotcache_struct {
+  glui32 addr;
+  aotfunc_t func; /* NULL if no translated function contains addr */
+} aotcache_t;
+
+/* Set whenever the interpreter reaches a place where translated code
+   might be entered. */
+int aot_trigger = FALSE;
+
+static aotcache_t *aotcache = NULL;
+
+static aotfunc_t find_function(glui32 addr);
+
+/* init_aot():
+   Check whether the precompiled story matches the game, and if so, set
+   up the lookup cache. If the cache can't be allocated, we just run
+   without the translated code.
+*/
+void init_aot()
+{
+  int ix;
+
+  if (aot_story_checksum != checksum)
+    return;
+
+  if (!aotcache) {
+    aotcache = (aotcache_t *)glulx_malloc(AOT_CACHE_SIZE
+      * sizeof(aotcache_t));
+    if (!aotcache)
+      return;
+  }
+
+  for (ix=0; ix<AOT_CACHE_SIZE; ix++) {
+    aotcache[ix].addr = 0;
+    aotcache[ix].func = NULL;
+  }
+}
+
+/* final_aot():
+   Throw away the lookup cache when the VM shuts down.
+*/
+void final_aot()
+{
+  if (aotcache) {
+    glulx_free(aotcache);
+    aotcache = NULL;
+  }
+}
+
+/* find_function():
+   Return the translated function containing addr, or NULL if there
+   isn't one.
+*/
+static aotfunc_t find_function(glui32 addr)
+{
+  aotcache_t *ent;
+  glui32 lo, hi, mid;
+
+  ent = &(aotcache[(addr ^ (addr >> 11)) & (AOT_CACHE_SIZE-1)]);
+  if (ent->addr == addr)
+    return ent->func;
+
+  /* Binary search for the last function which starts at or before
+     addr. */
+  ent->addr = addr;
+  ent->func = NULL;
+  lo = 0;
+  hi = aot_story_count;
+  while (lo < hi) {
+    mid = (lo + hi) / 2;
+    if (aot_story_funcs[mid].start <= addr)
+      lo = mid+1;
+    else
+      hi = mid;
+  }
+  if (lo > 0 && addr < aot_story_funcs[lo-1].end)
+    ent->func = aot_story_funcs[lo-1].func;
+  return ent->func;
+}
+
+/* aot_execute():
+   Called by the interpreter when it reaches a place where translated
+   code might be entered. This runs the translated code for addr, if
+   there is any, and then any further translated code that follows.
+   Returns the address at which the interpreter should continue; this
+   is addr itself if nothing was run.
+*/
+glui32 aot_execute(glui32 addr)
+{
+  int chain;
+  aotfunc_t func;
+  glui32 newaddr;
+
+  if (!aotcache)
+    return addr;
+
+  for (chain=0; chain<AOT_CHAIN_LIMIT; chain++) {
+    func = find_function(addr);
+    if (!func)
+      break;
+    newaddr = func(addr);
+    if (newaddr == 0)
+      break;
+
+    /* The translated code stopped at an instruction the interpreter
+       must execute (or at the end of its loop budget). Try again
+       after that. */
+    aot_trigger = TRUE;
+    if (newaddr == addr)
+      break;
+    addr = newaddr;
+  }
+
+  return addr;
+}
+
+#endif /* PRECOMPILED_STORY */
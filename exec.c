@@ -18,6 +18,106 @@
 
 #endif /* FLOAT_SUPPORT */
 
+/* If DISPATCH_TABLE is defined, and the compiler supports taking the
+   address of a label (a GCC extension, which Clang also supports), we
+   jump straight to each opcode's handler through a table. Otherwise,
+   the OPCASE() macro is just a case label, and the switch statements
+   below do all the work. */
+#if defined(DISPATCH_TABLE) && defined(__GNUC__)
+#define USE_DISPATCH_TABLE (1)
+#define DISPATCH_TABLE_SIZE (0x240)
+#define OPCASE(op) case op: op##_label
+#else /* DISPATCH_TABLE */
+#define OPCASE(op) case op
+#endif /* DISPATCH_TABLE */
+
+/* NEXT_OPCODE ends an opcode's handler. With the dispatch table and the
+   decode cache, it fetches the next instruction's cached decoding and
+   jumps straight to its handler, so that each handler has its own
+   indirect jump (which the CPU can predict separately). If anything
+   needs the top of the loop -- the end of execution, a JIT or
+   precompiled-code trigger, an instruction not in the cache, a fused
+   pair -- it goes there instead. (Ticks are counted in either place.)
+   Without the dispatch table, it's just the end of the switch case. */
+#ifdef JIT_COMPILER
+#define CODE_TRIGGERED (jit_trigger)
+#elif defined(PRECOMPILED_STORY)
+#define CODE_TRIGGERED (aot_trigger)
+#else
+#define CODE_TRIGGERED (0)
+#endif
+
+/* Count one instruction toward the next tick. This happens once every
+   tick_interval instructions; the profiler's and debugger's instruction
+   counters are brought up to date at the same time. */
+#define TICK_INSTRUCTION()  \
+  if (--tickcount == 0) {  \
+    tickcount = tick_interval;  \
+    profile_ticks(tick_interval);  \
+    debugger_ticks(tick_interval);  \
+    glk_tick();  \
+  }
+
+#if defined(USE_DISPATCH_TABLE) && defined(DECODE_CACHE)
+#ifdef FUSED_OPCODES
+#define DEC_FUSED(dec) ((dec)->fusion)
+#else /* FUSED_OPCODES */
+#define DEC_FUSED(dec) (0)
+#endif /* FUSED_OPCODES */
+#define NEXT_OPCODE  \
+  if (!done_executing && !CODE_TRIGGERED  \
+    && pc < ramstart && decodecache  \
+    && (dec = &(decodecache[pc & (DECODE_CACHE_SIZE-1)]))->addr == pc  \
+    && !DEC_FUSED(dec) && dec->opcode < DISPATCH_TABLE_SIZE) {  \
+    TICK_INSTRUCTION();  \
+    prevpc = pc;  \
+    opcode = dec->opcode;  \
+    pc = dec->nextaddr;  \
+    parse_decoded_operands(inst, dec);  \
+    goto *dispatch_table[opcode];  \
+  }  \
+  continue
+#elif defined(USE_DISPATCH_TABLE)
+#define NEXT_OPCODE continue
+#else /* USE_DISPATCH_TABLE */
+#define NEXT_OPCODE break
+#endif /* USE_DISPATCH_TABLE */
+
+/* STORE_RESULT() stores an opcode's result in a store operand, just as
+   store_operand() does. The common destinations (a local, a push onto
+   the stack, or a verified main-memory address) are handled in line,
+   so the arithmetic and load opcodes skip the function call and its
+   switch. Anything else, including a stack overflow, goes to
+   store_operand(). STORE_RESULT_S() and STORE_RESULT_B() are the same
+   for two- and one-byte stores. */
+#define STORE_RESULT_GEN(arg, val, width)  \
+  do {  \
+    glui32 storeval = (val);  \
+    if ((arg).desttype == 2) {  \
+      StkW##width((arg).value+localsbase, storeval);  \
+    }  \
+    else if ((arg).desttype == 3 && stackptr+4 <= stacksize) {  \
+      StkW4(stackptr, storeval);  \
+      stackptr += 4;  \
+    }  \
+    else if ((arg).desttype == 4) {  \
+      WatchW((arg).value);  \
+      Write##width(memmap+(arg).value, storeval);  \
+    }  \
+    else if (width == 4) {  \
+      store_operand((arg).desttype, (arg).value, storeval);  \
+    }  \
+    else if (width == 2) {  \
+      store_operand_s((arg).desttype, (arg).value, storeval);  \
+    }  \
+    else {  \
+      store_operand_b((arg).desttype, (arg).value, storeval);  \
+    }  \
+  } while (0)
+#define STORE_RESULT(arg, val)  STORE_RESULT_GEN(arg, val, 4)
+#define STORE_RESULT_S(arg, val)  STORE_RESULT_GEN(arg, (val) & 0xFFFF, 2)
+#define STORE_RESULT_B(arg, val)  STORE_RESULT_GEN(arg, (val) & 0xFF, 1)
+
 /* execute_loop():
    The main interpreter loop. This repeats until the program is done.
 */
@@ -32,6 +132,10 @@ void execute_loop()
   glsi32 vals0, vals1;
   glui32 *arglist;
   glui32 arglistfix[3];
+  glui32 tickcount;
+#ifdef DECODE_CACHE
+  decodedinst_t *dec;
+#endif /* DECODE_CACHE */
   
 #ifdef FLOAT_SUPPORT
   gfloat32 valf, valf1, valf2;
@@ -41,177 +145,405 @@ void execute_loop()
 #endif /* DOUBLE_SUPPORT */
 #endif /* FLOAT_SUPPORT */
 
+#ifdef USE_DISPATCH_TABLE
+  /* Opcodes without a handler here (including any added by
+     GLULX_EXTEND_OPCODES) fall back to the switch statements. The
+     table is filled in the first time we get here. */
+  static const void *dispatch_table[DISPATCH_TABLE_SIZE];
+  static int dispatch_table_ready = FALSE;
+
+  if (!dispatch_table_ready) {
+    for (ix=0; ix<DISPATCH_TABLE_SIZE; ix++)
+      dispatch_table[ix] = &&DispatchBySwitch;
+    dispatch_table[op_nop] = &&op_nop_label;
+    dispatch_table[op_add] = &&op_add_label;
+    dispatch_table[op_sub] = &&op_sub_label;
+    dispatch_table[op_mul] = &&op_mul_label;
+    dispatch_table[op_div] = &&op_div_label;
+    dispatch_table[op_mod] = &&op_mod_label;
+    dispatch_table[op_neg] = &&op_neg_label;
+    dispatch_table[op_bitand] = &&op_bitand_label;
+    dispatch_table[op_bitor] = &&op_bitor_label;
+    dispatch_table[op_bitxor] = &&op_bitxor_label;
+    dispatch_table[op_bitnot] = &&op_bitnot_label;
+    dispatch_table[op_shiftl] = &&op_shiftl_label;
+    dispatch_table[op_ushiftr] = &&op_ushiftr_label;
+    dispatch_table[op_sshiftr] = &&op_sshiftr_label;
+    dispatch_table[op_jump] = &&op_jump_label;
+    dispatch_table[op_jz] = &&op_jz_label;
+    dispatch_table[op_jnz] = &&op_jnz_label;
+    dispatch_table[op_jeq] = &&op_jeq_label;
+    dispatch_table[op_jne] = &&op_jne_label;
+    dispatch_table[op_jlt] = &&op_jlt_label;
+    dispatch_table[op_jgt] = &&op_jgt_label;
+    dispatch_table[op_jle] = &&op_jle_label;
+    dispatch_table[op_jge] = &&op_jge_label;
+    dispatch_table[op_jltu] = &&op_jltu_label;
+    dispatch_table[op_jgtu] = &&op_jgtu_label;
+    dispatch_table[op_jleu] = &&op_jleu_label;
+    dispatch_table[op_jgeu] = &&op_jgeu_label;
+    dispatch_table[op_call] = &&op_call_label;
+    dispatch_table[op_return] = &&op_return_label;
+    dispatch_table[op_tailcall] = &&op_tailcall_label;
+    dispatch_table[op_catch] = &&op_catch_label;
+    dispatch_table[op_throw] = &&op_throw_label;
+    dispatch_table[op_copy] = &&op_copy_label;
+    dispatch_table[op_copys] = &&op_copys_label;
+    dispatch_table[op_copyb] = &&op_copyb_label;
+    dispatch_table[op_sexs] = &&op_sexs_label;
+    dispatch_table[op_sexb] = &&op_sexb_label;
+    dispatch_table[op_aload] = &&op_aload_label;
+    dispatch_table[op_aloads] = &&op_aloads_label;
+    dispatch_table[op_aloadb] = &&op_aloadb_label;
+    dispatch_table[op_aloadbit] = &&op_aloadbit_label;
+    dispatch_table[op_astore] = &&op_astore_label;
+    dispatch_table[op_astores] = &&op_astores_label;
+    dispatch_table[op_astoreb] = &&op_astoreb_label;
+    dispatch_table[op_astorebit] = &&op_astorebit_label;
+    dispatch_table[op_stkcount] = &&op_stkcount_label;
+    dispatch_table[op_stkpeek] = &&op_stkpeek_label;
+    dispatch_table[op_stkswap] = &&op_stkswap_label;
+    dispatch_table[op_stkcopy] = &&op_stkcopy_label;
+    dispatch_table[op_stkroll] = &&op_stkroll_label;
+    dispatch_table[op_streamchar] = &&op_streamchar_label;
+    dispatch_table[op_streamunichar] = &&op_streamunichar_label;
+    dispatch_table[op_streamnum] = &&op_streamnum_label;
+    dispatch_table[op_streamstr] = &&op_streamstr_label;
+    dispatch_table[op_gestalt] = &&op_gestalt_label;
+    dispatch_table[op_debugtrap] = &&op_debugtrap_label;
+    dispatch_table[op_jumpabs] = &&op_jumpabs_label;
+    dispatch_table[op_callf] = &&op_callf_label;
+    dispatch_table[op_callfi] = &&op_callfi_label;
+    dispatch_table[op_callfii] = &&op_callfii_label;
+    dispatch_table[op_callfiii] = &&op_callfiii_label;
+    dispatch_table[op_getmemsize] = &&op_getmemsize_label;
+    dispatch_table[op_setmemsize] = &&op_setmemsize_label;
+    dispatch_table[op_getstringtbl] = &&op_getstringtbl_label;
+    dispatch_table[op_setstringtbl] = &&op_setstringtbl_label;
+    dispatch_table[op_getiosys] = &&op_getiosys_label;
+    dispatch_table[op_setiosys] = &&op_setiosys_label;
+    dispatch_table[op_glk] = &&op_glk_label;
+    dispatch_table[op_random] = &&op_random_label;
+    dispatch_table[op_setrandom] = &&op_setrandom_label;
+    dispatch_table[op_verify] = &&op_verify_label;
+    dispatch_table[op_restart] = &&op_restart_label;
+    dispatch_table[op_protect] = &&op_protect_label;
+    dispatch_table[op_save] = &&op_save_label;
+    dispatch_table[op_restore] = &&op_restore_label;
+    dispatch_table[op_saveundo] = &&op_saveundo_label;
+    dispatch_table[op_restoreundo] = &&op_restoreundo_label;
+    dispatch_table[op_hasundo] = &&op_hasundo_label;
+    dispatch_table[op_discardundo] = &&op_discardundo_label;
+    dispatch_table[op_quit] = &&op_quit_label;
+    dispatch_table[op_linearsearch] = &&op_linearsearch_label;
+    dispatch_table[op_binarysearch] = &&op_binarysearch_label;
+    dispatch_table[op_linkedsearch] = &&op_linkedsearch_label;
+    dispatch_table[op_malloc] = &&op_malloc_label;
+    dispatch_table[op_mfree] = &&op_mfree_label;
+    dispatch_table[op_accelfunc] = &&op_accelfunc_label;
+    dispatch_table[op_accelparam] = &&op_accelparam_label;
+#ifdef FLOAT_SUPPORT
+    dispatch_table[op_numtof] = &&op_numtof_label;
+    dispatch_table[op_ftonumz] = &&op_ftonumz_label;
+    dispatch_table[op_ftonumn] = &&op_ftonumn_label;
+    dispatch_table[op_fadd] = &&op_fadd_label;
+    dispatch_table[op_fsub] = &&op_fsub_label;
+    dispatch_table[op_fmul] = &&op_fmul_label;
+    dispatch_table[op_fdiv] = &&op_fdiv_label;
+    dispatch_table[op_fmod] = &&op_fmod_label;
+    dispatch_table[op_floor] = &&op_floor_label;
+    dispatch_table[op_ceil] = &&op_ceil_label;
+    dispatch_table[op_sqrt] = &&op_sqrt_label;
+    dispatch_table[op_log] = &&op_log_label;
+    dispatch_table[op_exp] = &&op_exp_label;
+    dispatch_table[op_pow] = &&op_pow_label;
+    dispatch_table[op_sin] = &&op_sin_label;
+    dispatch_table[op_cos] = &&op_cos_label;
+    dispatch_table[op_tan] = &&op_tan_label;
+    dispatch_table[op_asin] = &&op_asin_label;
+    dispatch_table[op_acos] = &&op_acos_label;
+    dispatch_table[op_atan] = &&op_atan_label;
+    dispatch_table[op_atan2] = &&op_atan2_label;
+    dispatch_table[op_jisinf] = &&op_jisinf_label;
+    dispatch_table[op_jisnan] = &&op_jisnan_label;
+    dispatch_table[op_jfeq] = &&op_jfeq_label;
+    dispatch_table[op_jfne] = &&op_jfne_label;
+    dispatch_table[op_jflt] = &&op_jflt_label;
+    dispatch_table[op_jfgt] = &&op_jfgt_label;
+    dispatch_table[op_jfle] = &&op_jfle_label;
+    dispatch_table[op_jfge] = &&op_jfge_label;
+#ifdef DOUBLE_SUPPORT   /* Inside FLOAT_SUPPORT! */
+    dispatch_table[op_numtod] = &&op_numtod_label;
+    dispatch_table[op_dtonumz] = &&op_dtonumz_label;
+    dispatch_table[op_dtonumn] = &&op_dtonumn_label;
+    dispatch_table[op_ftod] = &&op_ftod_label;
+    dispatch_table[op_dtof] = &&op_dtof_label;
+    dispatch_table[op_dadd] = &&op_dadd_label;
+    dispatch_table[op_dsub] = &&op_dsub_label;
+    dispatch_table[op_dmul] = &&op_dmul_label;
+    dispatch_table[op_ddiv] = &&op_ddiv_label;
+    dispatch_table[op_dmodr] = &&op_dmodr_label;
+    dispatch_table[op_dmodq] = &&op_dmodq_label;
+    dispatch_table[op_dfloor] = &&op_dfloor_label;
+    dispatch_table[op_dceil] = &&op_dceil_label;
+    dispatch_table[op_dsqrt] = &&op_dsqrt_label;
+    dispatch_table[op_dlog] = &&op_dlog_label;
+    dispatch_table[op_dexp] = &&op_dexp_label;
+    dispatch_table[op_dpow] = &&op_dpow_label;
+    dispatch_table[op_dsin] = &&op_dsin_label;
+    dispatch_table[op_dcos] = &&op_dcos_label;
+    dispatch_table[op_dtan] = &&op_dtan_label;
+    dispatch_table[op_dasin] = &&op_dasin_label;
+    dispatch_table[op_dacos] = &&op_dacos_label;
+    dispatch_table[op_datan] = &&op_datan_label;
+    dispatch_table[op_datan2] = &&op_datan2_label;
+    dispatch_table[op_jdisinf] = &&op_jdisinf_label;
+    dispatch_table[op_jdisnan] = &&op_jdisnan_label;
+    dispatch_table[op_jdeq] = &&op_jdeq_label;
+    dispatch_table[op_jdne] = &&op_jdne_label;
+    dispatch_table[op_jdlt] = &&op_jdlt_label;
+    dispatch_table[op_jdgt] = &&op_jdgt_label;
+    dispatch_table[op_jdle] = &&op_jdle_label;
+    dispatch_table[op_jdge] = &&op_jdge_label;
+#endif /* DOUBLE_SUPPORT */
+#endif /* FLOAT_SUPPORT */
+    dispatch_table_ready = TRUE;
+  }
+#endif /* USE_DISPATCH_TABLE */
+
+  tickcount = tick_interval;
+
   while (!done_executing) {
 
-    profile_tick();
-    debugger_tick();
     /* Do OS-specific processing, if appropriate. */
-    glk_tick();
+    TICK_INSTRUCTION();
     
+#ifdef JIT_COMPILER
+    /* If we've just entered a function or jumped backward, there may
+       be translated code to run from here. */
+    if (jit_trigger) {
+      jit_trigger = FALSE;
+      pc = jit_execute(pc);
+    }
+#endif /* JIT_COMPILER */
+
+#ifdef PRECOMPILED_STORY
+    /* Likewise for the precompiled story's translated code. */
+    if (aot_trigger) {
+      aot_trigger = FALSE;
+      pc = aot_execute(pc);
+    }
+#endif /* PRECOMPILED_STORY */
+
     /* Stash the current opcode's address, in case the interpreter needs to serialize the VM state out-of-band. */
     prevpc = pc;
     
-    /* Fetch the opcode number. */
-    opcode = Mem1(pc);
-    pc++;
-    if (opcode & 0x80) {
-      /* More than one-byte opcode. */
-      if (opcode & 0x40) {
-        /* Four-byte opcode */
-        opcode &= 0x3F;
-        opcode = (opcode << 8) | Mem1(pc);
-        pc++;
-        opcode = (opcode << 8) | Mem1(pc);
-        pc++;
-        opcode = (opcode << 8) | Mem1(pc);
-        pc++;
-      }
-      else {
-        /* Two-byte opcode */
-        opcode &= 0x7F;
-        opcode = (opcode << 8) | Mem1(pc);
-        pc++;
-      }
+#ifdef DECODE_CACHE
+    /* If this instruction is in ROM, we can use (or create) its cached
+       decoding, and skip the work of fetching and parsing it. */
+    dec = NULL;
+    if (pc < ramstart && decodecache) {
+      dec = &(decodecache[pc & (DECODE_CACHE_SIZE-1)]);
+      if (dec->addr != pc && !decode_instruction(dec, pc))
+        dec = NULL;
     }
 
-    /* Now we have an opcode number. */
-    
-    /* Fetch the structure that describes how the operands for this
-       opcode are arranged. This is a pointer to an immutable, 
-       static object. */
-    if (opcode < 0x80)
-      oplist = fast_operandlist[opcode];
+    if (dec) {
+      opcode = dec->opcode;
+      pc = dec->nextaddr;
+      parse_decoded_operands(inst, dec);
+    }
     else
-      oplist = lookup_operandlist(opcode);
+#endif /* DECODE_CACHE */
+    {
+      /* Fetch the opcode number. */
+      opcode = Mem1(pc);
+      pc++;
+      if (opcode & 0x80) {
+        /* More than one-byte opcode. */
+        if (opcode & 0x40) {
+          /* Four-byte opcode */
+          opcode &= 0x3F;
+          opcode = (opcode << 8) | Mem1(pc);
+          pc++;
+          opcode = (opcode << 8) | Mem1(pc);
+          pc++;
+          opcode = (opcode << 8) | Mem1(pc);
+          pc++;
+        }
+        else {
+          /* Two-byte opcode */
+          opcode &= 0x7F;
+          opcode = (opcode << 8) | Mem1(pc);
+          pc++;
+        }
+      }
+
+      /* Now we have an opcode number. */
+    
+      /* Fetch the structure that describes how the operands for this
+         opcode are arranged. This is a pointer to an immutable, 
+         static object. */
+      if (opcode < 0x80)
+        oplist = fast_operandlist[opcode];
+      else
+        oplist = lookup_operandlist(opcode);
+
+      if (!oplist)
+        fatal_error_i("Encountered unknown opcode.", opcode);
+
+      /* Based on the oplist structure, load the actual operand values
+         into inst. This moves the PC up to the end of the instruction.
+         Most oplists have their own parser function for this. */
+      if (oplist->parser)
+        oplist->parser(inst);
+      else
+        parse_operands(inst, oplist);
+    }
 
-    if (!oplist)
-      fatal_error_i("Encountered unknown opcode.", opcode);
+#ifdef FUSED_OPCODES
+    /* If this instruction is fused with the next one, perform both of
+       them here. (See fuse_instruction() in operand.c.) */
+    if (dec && dec->fusion) {
+      pc = dec->fusednext;
+
+      if (dec->fusion == fuse_CopyAdd) {
+        /* The @add's first operand is the local we just copied to. */
+        STORE_RESULT(inst[1], inst[0].value);
+        if (dec->fusedkinds[1] == dkind_LoadLocal)
+          val1 = Stk4(dec->fusedvalues[1]+localsbase);
+        else
+          val1 = dec->fusedvalues[1];
+        value = inst[0].value + val1;
+        store_operand(dec->fusedkinds[2]-dkind_Store, dec->fusedvalues[2], 
+          value);
+        continue;
+      }
+
+      /* fuse_LoadBranch. The loaded value would normally be pushed and
+         then popped, so we still check for stack overflow. */
+      value = inst[0].value;
+      if (opcode == op_aload) {
+        value += 4 * inst[1].value;
+        val0 = Mem4(value);
+      }
+      else if (opcode == op_aloads) {
+        value += 2 * inst[1].value;
+        val0 = Mem2(value);
+      }
+      else {
+        value += inst[1].value;
+        val0 = Mem1(value);
+      }
+      if (stackptr+4 > stacksize)
+        fatal_error("Stack overflow in store operand.");
 
-    /* Based on the oplist structure, load the actual operand values
-       into inst. This moves the PC up to the end of the instruction. */
-    parse_operands(inst, oplist);
+      switch (dec->fusedop) {
+      case op_jz:
+        if (val0 == 0) {
+          value = dec->fusedvalues[1];
+          goto PerformJump;
+        }
+        break;
+      case op_jnz:
+        if (val0 != 0) {
+          value = dec->fusedvalues[1];
+          goto PerformJump;
+        }
+        break;
+      case op_jeq:
+      case op_jne:
+        if (dec->fusedkinds[1] == dkind_LoadLocal)
+          val1 = Stk4(dec->fusedvalues[1]+localsbase);
+        else
+          val1 = dec->fusedvalues[1];
+        if (dec->fusedop == op_jeq ? (val0 == val1) : (val0 != val1)) {
+          value = dec->fusedvalues[2];
+          goto PerformJump;
+        }
+        break;
+      }
+      continue;
+    }
+#endif /* FUSED_OPCODES */
 
     /* Perform the opcode. This switch statement is split in two, based
        on some paranoid suspicions about the ability of compilers to
        optimize large-range switches. Ignore that. */
 
+#ifdef USE_DISPATCH_TABLE
+    if (opcode < DISPATCH_TABLE_SIZE)
+      goto *dispatch_table[opcode];
+  DispatchBySwitch:
+#endif /* USE_DISPATCH_TABLE */
+
     if (opcode < 0x80) {
 
       switch (opcode) {
 
-      case op_nop:
-        break;
+      OPCASE(op_nop):
+        NEXT_OPCODE;
 
-      case op_add:
+      OPCASE(op_add):
         value = inst[0].value + inst[1].value;
-        store_operand(inst[2].desttype, inst[2].value, value);
-        break;
-      case op_sub:
+        STORE_RESULT(inst[2], value);
+        NEXT_OPCODE;
+      OPCASE(op_sub):
         value = inst[0].value - inst[1].value;
-        store_operand(inst[2].desttype, inst[2].value, value);
-        break;
-      case op_mul:
+        STORE_RESULT(inst[2], value);
+        NEXT_OPCODE;
+      OPCASE(op_mul):
         value = inst[0].value * inst[1].value;
-        store_operand(inst[2].desttype, inst[2].value, value);
-        break;
-      case op_div:
-        vals0 = inst[0].value;
-        vals1 = inst[1].value;
-        if (vals1 == 0)
-          fatal_error("Division by zero.");
-        if (vals1 == -1 && (glui32)vals0 == 0x80000000)
-          fatal_error("Division overflow.");
-        /* Since C doesn't guarantee the results of division of negative
-           numbers, we carefully convert everything to positive values
-           first. They have to be unsigned values, too, otherwise the
-           0x80000000 case goes wonky. */
-        if (vals0 < 0) {
-          val0 = (-(glui32)vals0);
-          if (vals1 < 0) {
-            val1 = (-(glui32)vals1);
-            value = val0 / val1;
-          }
-          else {
-            val1 = vals1;
-            value = -(val0 / val1);
-          }
-        }
-        else {
-          val0 = vals0;
-          if (vals1 < 0) {
-            val1 = (-(glui32)vals1);
-            value = -(val0 / val1);
-          }
-          else {
-            val1 = vals1;
-            value = val0 / val1;
-          }
-        }
-        store_operand(inst[2].desttype, inst[2].value, value);
-        break;
-      case op_mod:
-        vals0 = inst[0].value;
-        vals1 = inst[1].value;
-        if (vals1 == 0)
-          fatal_error("Division by zero doing remainder.");
-        if (vals1 == -1 && (glui32)vals0 == 0x80000000)
-          fatal_error("Division overflow doing remainder.");
-        if (vals1 < 0) {
-            val1 = -(glui32)vals1;
-        }
-        else {
-            val1 = vals1;
-        }
-        if (vals0 < 0) {
-          val0 = (-(glui32)vals0);
-          value = -(val0 % val1);
-        }
-        else {
-          val0 = vals0;
-          value = val0 % val1;
-        }
-        store_operand(inst[2].desttype, inst[2].value, value);
-        break;
-      case op_neg:
+        STORE_RESULT(inst[2], value);
+        NEXT_OPCODE;
+      OPCASE(op_div):
+        value = perform_divide(inst[0].value, inst[1].value);
+        STORE_RESULT(inst[2], value);
+        NEXT_OPCODE;
+      OPCASE(op_mod):
+        value = perform_remainder(inst[0].value, inst[1].value);
+        STORE_RESULT(inst[2], value);
+        NEXT_OPCODE;
+      OPCASE(op_neg):
         vals0 = inst[0].value;
         value = (-(glui32)vals0);
-        store_operand(inst[1].desttype, inst[1].value, value);
-        break;
+        STORE_RESULT(inst[1], value);
+        NEXT_OPCODE;
 
-      case op_bitand:
+      OPCASE(op_bitand):
         value = (inst[0].value & inst[1].value);
-        store_operand(inst[2].desttype, inst[2].value, value);
-        break;
-      case op_bitor:
+        STORE_RESULT(inst[2], value);
+        NEXT_OPCODE;
+      OPCASE(op_bitor):
         value = (inst[0].value | inst[1].value);
-        store_operand(inst[2].desttype, inst[2].value, value);
-        break;
-      case op_bitxor:
+        STORE_RESULT(inst[2], value);
+        NEXT_OPCODE;
+      OPCASE(op_bitxor):
         value = (inst[0].value ^ inst[1].value);
-        store_operand(inst[2].desttype, inst[2].value, value);
-        break;
-      case op_bitnot:
+        STORE_RESULT(inst[2], value);
+        NEXT_OPCODE;
+      OPCASE(op_bitnot):
         value = ~(inst[0].value);
-        store_operand(inst[1].desttype, inst[1].value, value);
-        break;
+        STORE_RESULT(inst[1], value);
+        NEXT_OPCODE;
 
-      case op_shiftl:
+      OPCASE(op_shiftl):
         vals0 = inst[1].value;
         if (vals0 < 0 || vals0 >= 32)
           value = 0;
         else
           value = ((glui32)(inst[0].value) << (glui32)vals0);
-        store_operand(inst[2].desttype, inst[2].value, value);
-        break;
-      case op_ushiftr:
+        STORE_RESULT(inst[2], value);
+        NEXT_OPCODE;
+      OPCASE(op_ushiftr):
         vals0 = inst[1].value;
         if (vals0 < 0 || vals0 >= 32)
           value = 0;
         else
           value = ((glui32)(inst[0].value) >> (glui32)vals0);
-        store_operand(inst[2].desttype, inst[2].value, value);
-        break;
-      case op_sshiftr:
+        STORE_RESULT(inst[2], value);
+        NEXT_OPCODE;
+      OPCASE(op_sshiftr):
         vals0 = inst[1].value;
         if (vals0 < 0 || vals0 >= 32) {
           if (inst[0].value & 0x80000000)
@@ -225,10 +557,10 @@ void execute_loop()
              We'll assume it for now. */
           value = ((glsi32)(inst[0].value) >> (glsi32)vals0);
         }
-        store_operand(inst[2].desttype, inst[2].value, value);
-        break;
+        STORE_RESULT(inst[2], value);
+        NEXT_OPCODE;
 
-      case op_jump:
+      OPCASE(op_jump):
         value = inst[0].value;
         /* fall through to PerformJump label. */
 
@@ -247,186 +579,194 @@ void execute_loop()
         else {
           /* Branch to a new PC value. */
           pc = (pc + value - 2);
-        }
-        break;
-
-      case op_jz:
+#ifdef JIT_COMPILER
+          if ((glsi32)value < 2)
+            jit_trigger = TRUE;
+#endif /* JIT_COMPILER */
+#ifdef PRECOMPILED_STORY
+          if ((glsi32)value < 2)
+            aot_trigger = TRUE;
+#endif /* PRECOMPILED_STORY */
+        }
+        NEXT_OPCODE;
+
+      OPCASE(op_jz):
         if (inst[0].value == 0) {
           value = inst[1].value;
           goto PerformJump;
         }
-        break;
-      case op_jnz:
+        NEXT_OPCODE;
+      OPCASE(op_jnz):
         if (inst[0].value != 0) {
           value = inst[1].value;
           goto PerformJump;
         }
-        break;
-      case op_jeq:
+        NEXT_OPCODE;
+      OPCASE(op_jeq):
         if (inst[0].value == inst[1].value) {
           value = inst[2].value;
           goto PerformJump;
         }
-        break;
-      case op_jne:
+        NEXT_OPCODE;
+      OPCASE(op_jne):
         if (inst[0].value != inst[1].value) {
           value = inst[2].value;
           goto PerformJump;
         }
-        break;
-      case op_jlt:
+        NEXT_OPCODE;
+      OPCASE(op_jlt):
         vals0 = inst[0].value;
         vals1 = inst[1].value;
         if (vals0 < vals1) {
           value = inst[2].value;
           goto PerformJump;
         }
-        break;
-      case op_jgt:
+        NEXT_OPCODE;
+      OPCASE(op_jgt):
         vals0 = inst[0].value;
         vals1 = inst[1].value;
         if (vals0 > vals1) {
           value = inst[2].value;
           goto PerformJump;
         }
-        break;
-      case op_jle:
+        NEXT_OPCODE;
+      OPCASE(op_jle):
         vals0 = inst[0].value;
         vals1 = inst[1].value;
         if (vals0 <= vals1) {
           value = inst[2].value;
           goto PerformJump;
         }
-        break;
-      case op_jge:
+        NEXT_OPCODE;
+      OPCASE(op_jge):
         vals0 = inst[0].value;
         vals1 = inst[1].value;
         if (vals0 >= vals1) {
           value = inst[2].value;
           goto PerformJump;
         }
-        break;
-      case op_jltu:
+        NEXT_OPCODE;
+      OPCASE(op_jltu):
         val0 = inst[0].value;
         val1 = inst[1].value;
         if (val0 < val1) {
           value = inst[2].value;
           goto PerformJump;
         }
-        break;
-      case op_jgtu:
+        NEXT_OPCODE;
+      OPCASE(op_jgtu):
         val0 = inst[0].value;
         val1 = inst[1].value;
         if (val0 > val1) {
           value = inst[2].value;
           goto PerformJump;
         }
-        break;
-      case op_jleu:
+        NEXT_OPCODE;
+      OPCASE(op_jleu):
         val0 = inst[0].value;
         val1 = inst[1].value;
         if (val0 <= val1) {
           value = inst[2].value;
           goto PerformJump;
         }
-        break;
-      case op_jgeu:
+        NEXT_OPCODE;
+      OPCASE(op_jgeu):
         val0 = inst[0].value;
         val1 = inst[1].value;
         if (val0 >= val1) {
           value = inst[2].value;
           goto PerformJump;
         }
-        break;
+        NEXT_OPCODE;
 
-      case op_call:
+      OPCASE(op_call):
         value = inst[1].value;
         arglist = pop_arguments(value, 0);
         push_callstub(inst[2].desttype, inst[2].value);
-        enter_function(inst[0].value, value, arglist);
-        break;
-      case op_return:
+        enter_function_from(prevpc, inst[0].value, value, arglist);
+        NEXT_OPCODE;
+      OPCASE(op_return):
         leave_function();
         if (stackptr == 0) {
           done_executing = TRUE;
           break;
         }
         pop_callstub(inst[0].value);
-        break;
-      case op_tailcall:
+        NEXT_OPCODE;
+      OPCASE(op_tailcall):
         value = inst[1].value;
         arglist = pop_arguments(value, 0);
         leave_function();
-        enter_function(inst[0].value, value, arglist);
-        break;
+        enter_function_from(prevpc, inst[0].value, value, arglist);
+        NEXT_OPCODE;
 
-      case op_catch:
+      OPCASE(op_catch):
         push_callstub(inst[0].desttype, inst[0].value);
         value = inst[1].value;
         val0 = stackptr;
-        store_operand(inst[0].desttype, inst[0].value, val0);
+        STORE_RESULT(inst[0], val0);
         goto PerformJump;
-        break;
-      case op_throw:
+        NEXT_OPCODE;
+      OPCASE(op_throw):
         profile_fail("throw");
         value = inst[0].value;
         stackptr = inst[1].value;
         pop_callstub(value);
-        break;
+        NEXT_OPCODE;
 
-      case op_copy:
+      OPCASE(op_copy):
         value = inst[0].value;
 #ifdef TOLERATE_SUPERGLUS_BUG
         if (inst[1].desttype == 1 && inst[1].value == 0)
             inst[1].desttype = 0;
 #endif /* TOLERATE_SUPERGLUS_BUG */
-        store_operand(inst[1].desttype, inst[1].value, value);
-        break;
-      case op_copys:
+        STORE_RESULT(inst[1], value);
+        NEXT_OPCODE;
+      OPCASE(op_copys):
         value = inst[0].value;
-        store_operand_s(inst[1].desttype, inst[1].value, value);
-        break;
-      case op_copyb:
+        STORE_RESULT_S(inst[1], value);
+        NEXT_OPCODE;
+      OPCASE(op_copyb):
         value = inst[0].value;
-        store_operand_b(inst[1].desttype, inst[1].value, value);
-        break;
+        STORE_RESULT_B(inst[1], value);
+        NEXT_OPCODE;
 
-      case op_sexs:
+      OPCASE(op_sexs):
         val0 = inst[0].value;
         if (val0 & 0x8000)
           val0 |= 0xFFFF0000;
         else
           val0 &= 0x0000FFFF;
-        store_operand(inst[1].desttype, inst[1].value, val0);
-        break;
-      case op_sexb:
+        STORE_RESULT(inst[1], val0);
+        NEXT_OPCODE;
+      OPCASE(op_sexb):
         val0 = inst[0].value;
         if (val0 & 0x80)
           val0 |= 0xFFFFFF00;
         else
           val0 &= 0x000000FF;
-        store_operand(inst[1].desttype, inst[1].value, val0);
-        break;
+        STORE_RESULT(inst[1], val0);
+        NEXT_OPCODE;
 
-      case op_aload:
+      OPCASE(op_aload):
         value = inst[0].value;
         value += 4 * inst[1].value;
         val0 = Mem4(value);
-        store_operand(inst[2].desttype, inst[2].value, val0);
-        break;
-      case op_aloads:
+        STORE_RESULT(inst[2], val0);
+        NEXT_OPCODE;
+      OPCASE(op_aloads):
         value = inst[0].value;
         value += 2 * inst[1].value;
         val0 = Mem2(value);
-        store_operand(inst[2].desttype, inst[2].value, val0);
-        break;
-      case op_aloadb:
+        STORE_RESULT(inst[2], val0);
+        NEXT_OPCODE;
+      OPCASE(op_aloadb):
         value = inst[0].value;
         value += inst[1].value;
         val0 = Mem1(value);
-        store_operand(inst[2].desttype, inst[2].value, val0);
-        break;
-      case op_aloadbit:
+        STORE_RESULT(inst[2], val0);
+        NEXT_OPCODE;
+      OPCASE(op_aloadbit):
         value = inst[0].value;
         vals0 = inst[1].value;
         val1 = (vals0 & 7);
@@ -438,28 +778,28 @@ void execute_loop()
           val0 = 1;
         else
           val0 = 0;
-        store_operand(inst[2].desttype, inst[2].value, val0);
-        break;
+        STORE_RESULT(inst[2], val0);
+        NEXT_OPCODE;
 
-      case op_astore:
+      OPCASE(op_astore):
         value = inst[0].value;
         value += 4 * inst[1].value;
         val0 = inst[2].value;
         MemW4(value, val0);
-        break;
-      case op_astores:
+        NEXT_OPCODE;
+      OPCASE(op_astores):
         value = inst[0].value;
         value += 2 * inst[1].value;
         val0 = inst[2].value;
         MemW2(value, val0);
-        break;
-      case op_astoreb:
+        NEXT_OPCODE;
+      OPCASE(op_astoreb):
         value = inst[0].value;
         value += inst[1].value;
         val0 = inst[2].value;
         MemW1(value, val0);
-        break;
-      case op_astorebit:
+        NEXT_OPCODE;
+      OPCASE(op_astorebit):
         value = inst[0].value;
         vals0 = inst[1].value;
         val1 = (vals0 & 7);
@@ -473,20 +813,20 @@ void execute_loop()
         else
           val0 &= ~((glui32)(1 << val1));
         MemW1(value, val0);
-        break;
+        NEXT_OPCODE;
 
-      case op_stkcount:
+      OPCASE(op_stkcount):
         value = (stackptr - valstackbase) / 4;
-        store_operand(inst[0].desttype, inst[0].value, value);
-        break;
-      case op_stkpeek:
+        STORE_RESULT(inst[0], value);
+        NEXT_OPCODE;
+      OPCASE(op_stkpeek):
         vals0 = inst[0].value * 4;
         if (vals0 < 0 || vals0 >= (stackptr - valstackbase))
           fatal_error("Stkpeek outside current stack range.");
         value = Stk4(stackptr - (vals0+4));
-        store_operand(inst[1].desttype, inst[1].value, value);
-        break;
-      case op_stkswap:
+        STORE_RESULT(inst[1], value);
+        NEXT_OPCODE;
+      OPCASE(op_stkswap):
         if (stackptr < valstackbase+8) {
           fatal_error("Stack underflow in stkswap.");
         }
@@ -494,8 +834,8 @@ void execute_loop()
         val1 = Stk4(stackptr-8);
         StkW4(stackptr-4, val1);
         StkW4(stackptr-8, val0);
-        break;
-      case op_stkcopy:
+        NEXT_OPCODE;
+      OPCASE(op_stkcopy):
         vals0 = inst[0].value;
         if (vals0 < 0)
           fatal_error("Negative operand in stkcopy.");
@@ -511,8 +851,8 @@ void execute_loop()
           StkW4(stackptr + ix*4, value);
         }
         stackptr += vals0*4;
-        break;
-      case op_stkroll:
+        NEXT_OPCODE;
+      OPCASE(op_stkroll):
         vals0 = inst[0].value;
         vals1 = inst[1].value;
         if (vals0 < 0)
@@ -544,31 +884,31 @@ void execute_loop()
           value = Stk4(addr + (vals1+ix)*4);
           StkW4(addr + ix*4, value);
         }
-        break;
+        NEXT_OPCODE;
 
-      case op_streamchar:
+      OPCASE(op_streamchar):
         profile_in(0xE0000001, stackptr, FALSE);
         value = inst[0].value & 0xFF;
         (*stream_char_handler)(value);
         profile_out(stackptr);
-        break;
-      case op_streamunichar:
+        NEXT_OPCODE;
+      OPCASE(op_streamunichar):
         profile_in(0xE0000002, stackptr, FALSE);
         value = inst[0].value;
         (*stream_unichar_handler)(value);
         profile_out(stackptr);
-        break;
-      case op_streamnum:
+        NEXT_OPCODE;
+      OPCASE(op_streamnum):
         profile_in(0xE0000003, stackptr, FALSE);
         vals0 = inst[0].value;
         stream_num(vals0, FALSE, 0);
         profile_out(stackptr);
-        break;
-      case op_streamstr:
+        NEXT_OPCODE;
+      OPCASE(op_streamstr):
         profile_in(0xE0000004, stackptr, FALSE);
         stream_string(inst[0].value, 0, 0);
         profile_out(stackptr);
-        break;
+        NEXT_OPCODE;
 
       default:
         fatal_error_i("Executed unknown opcode.", opcode);
@@ -578,12 +918,12 @@ void execute_loop()
 
       switch (opcode) {
 
-      case op_gestalt:
+      OPCASE(op_gestalt):
         value = do_gestalt(inst[0].value, inst[1].value);
         store_operand(inst[2].desttype, inst[2].value, value);
-        break;
+        NEXT_OPCODE;
 
-      case op_debugtrap:
+      OPCASE(op_debugtrap):
 #if VM_DEBUGGER
         /* We block and handle debug commands, but only if the
            library has invoked debug features. (Meaning, has
@@ -595,59 +935,59 @@ void execute_loop()
 #endif /* VM_DEBUGGER */
         fatal_error_i("user debugtrap encountered.", inst[0].value);
 
-      case op_jumpabs:
+      OPCASE(op_jumpabs):
         pc = inst[0].value;
-        break;
+        NEXT_OPCODE;
 
-      case op_callf:
+      OPCASE(op_callf):
         push_callstub(inst[1].desttype, inst[1].value);
-        enter_function(inst[0].value, 0, arglistfix);
-        break;
-      case op_callfi:
+        enter_function_from(prevpc, inst[0].value, 0, arglistfix);
+        NEXT_OPCODE;
+      OPCASE(op_callfi):
         arglistfix[0] = inst[1].value;
         push_callstub(inst[2].desttype, inst[2].value);
-        enter_function(inst[0].value, 1, arglistfix);
-        break;
-      case op_callfii:
+        enter_function_from(prevpc, inst[0].value, 1, arglistfix);
+        NEXT_OPCODE;
+      OPCASE(op_callfii):
         arglistfix[0] = inst[1].value;
         arglistfix[1] = inst[2].value;
         push_callstub(inst[3].desttype, inst[3].value);
-        enter_function(inst[0].value, 2, arglistfix);
-        break;
-      case op_callfiii:
+        enter_function_from(prevpc, inst[0].value, 2, arglistfix);
+        NEXT_OPCODE;
+      OPCASE(op_callfiii):
         arglistfix[0] = inst[1].value;
         arglistfix[1] = inst[2].value;
         arglistfix[2] = inst[3].value;
         push_callstub(inst[4].desttype, inst[4].value);
-        enter_function(inst[0].value, 3, arglistfix);
-        break;
+        enter_function_from(prevpc, inst[0].value, 3, arglistfix);
+        NEXT_OPCODE;
 
-      case op_getmemsize:
+      OPCASE(op_getmemsize):
         store_operand(inst[0].desttype, inst[0].value, endmem);
-        break;
-      case op_setmemsize:
+        NEXT_OPCODE;
+      OPCASE(op_setmemsize):
         value = change_memsize(inst[0].value, FALSE);
         store_operand(inst[1].desttype, inst[1].value, value);
-        break;
+        NEXT_OPCODE;
 
-      case op_getstringtbl:
+      OPCASE(op_getstringtbl):
         value = stream_get_table();
         store_operand(inst[0].desttype, inst[0].value, value);
-        break;
-      case op_setstringtbl:
+        NEXT_OPCODE;
+      OPCASE(op_setstringtbl):
         stream_set_table(inst[0].value);
-        break;
+        NEXT_OPCODE;
 
-      case op_getiosys:
+      OPCASE(op_getiosys):
         stream_get_iosys(&val0, &val1);
         store_operand(inst[0].desttype, inst[0].value, val0);
         store_operand(inst[1].desttype, inst[1].value, val1);
-        break;
-      case op_setiosys:
+        NEXT_OPCODE;
+      OPCASE(op_setiosys):
         stream_set_iosys(inst[0].value, inst[1].value);
-        break;
+        NEXT_OPCODE;
 
-      case op_glk:
+      OPCASE(op_glk):
         profile_in(0xF0000000+inst[0].value, stackptr, FALSE);
         value = inst[1].value;
         arglist = pop_arguments(value, 0);
@@ -658,9 +998,9 @@ void execute_loop()
 #endif /* TOLERATE_SUPERGLUS_BUG */
         store_operand(inst[2].desttype, inst[2].value, val0);
         profile_out(stackptr);
-        break;
+        NEXT_OPCODE;
 
-      case op_random:
+      OPCASE(op_random):
         vals0 = inst[0].value;
         if (vals0 == 0)
           value = glulx_random();
@@ -669,22 +1009,22 @@ void execute_loop()
         else 
           value = -(glulx_random() % (glui32)(-(glui32)vals0));
         store_operand(inst[1].desttype, inst[1].value, value);
-        break;
-      case op_setrandom:
+        NEXT_OPCODE;
+      OPCASE(op_setrandom):
         glulx_setrandom(inst[0].value);
-        break;
+        NEXT_OPCODE;
 
-      case op_verify:
+      OPCASE(op_verify):
         value = perform_verify();
         store_operand(inst[0].desttype, inst[0].value, value);
-        break;
+        NEXT_OPCODE;
 
-      case op_restart:
+      OPCASE(op_restart):
         profile_fail("restart");
         vm_restart();
-        break;
+        NEXT_OPCODE;
 
-      case op_protect:
+      OPCASE(op_protect):
         val0 = inst[0].value;
         val1 = val0 + inst[1].value;
         if (val0 == val1) {
@@ -693,15 +1033,15 @@ void execute_loop()
         }
         protectstart = val0;
         protectend = val1;
-        break;
+        NEXT_OPCODE;
 
-      case op_save:
+      OPCASE(op_save):
         push_callstub(inst[1].desttype, inst[1].value);
         value = perform_save(find_stream_by_id(inst[0].value));
         pop_callstub(value);
-        break;
+        NEXT_OPCODE;
 
-      case op_restore:
+      OPCASE(op_restore):
         value = perform_restore(find_stream_by_id(inst[0].value), FALSE);
         if (value == 0) {
           /* We've succeeded, and the stack now contains the callstub
@@ -714,15 +1054,15 @@ void execute_loop()
              operand. */
           store_operand(inst[1].desttype, inst[1].value, value);
         }
-        break;
+        NEXT_OPCODE;
 
-      case op_saveundo:
+      OPCASE(op_saveundo):
         push_callstub(inst[0].desttype, inst[0].value);
         value = perform_saveundo();
         pop_callstub(value);
-        break;
+        NEXT_OPCODE;
 
-      case op_restoreundo:
+      OPCASE(op_restoreundo):
         value = perform_restoreundo();
         if (value == 0) {
           /* We've succeeded, and the stack now contains the callstub
@@ -735,36 +1075,36 @@ void execute_loop()
              operand. */
           store_operand(inst[0].desttype, inst[0].value, value);
         }
-        break;
+        NEXT_OPCODE;
 
-      case op_hasundo:
+      OPCASE(op_hasundo):
         value = has_undo();
         store_operand(inst[0].desttype, inst[0].value, value);
-        break;
+        NEXT_OPCODE;
 
-      case op_discardundo:
+      OPCASE(op_discardundo):
         discard_undo();
-        break;
+        NEXT_OPCODE;
 
-      case op_quit:
+      OPCASE(op_quit):
         done_executing = TRUE;
-        break;
+        NEXT_OPCODE;
 
-      case op_linearsearch:
+      OPCASE(op_linearsearch):
         value = linear_search(inst[0].value, inst[1].value, inst[2].value, 
           inst[3].value, inst[4].value, inst[5].value, inst[6].value);
         store_operand(inst[7].desttype, inst[7].value, value);
-        break;
-      case op_binarysearch:
+        NEXT_OPCODE;
+      OPCASE(op_binarysearch):
         value = binary_search(inst[0].value, inst[1].value, inst[2].value, 
           inst[3].value, inst[4].value, inst[5].value, inst[6].value);
         store_operand(inst[7].desttype, inst[7].value, value);
-        break;
-      case op_linkedsearch:
+        NEXT_OPCODE;
+      OPCASE(op_linkedsearch):
         value = linked_search(inst[0].value, inst[1].value, inst[2].value, 
           inst[3].value, inst[4].value, inst[5].value);
         store_operand(inst[6].desttype, inst[6].value, value);
-        break;
+        NEXT_OPCODE;
 
       case op_mzero: {
         glui32 lx;
@@ -774,7 +1114,7 @@ void execute_loop()
           MemW1(addr, 0);
         }
         }
-        break;
+        NEXT_OPCODE;
       case op_mcopy: {
         glui32 lx;
         glui32 count = inst[0].value;
@@ -795,30 +1135,30 @@ void execute_loop()
           }
         }
         }
-        break;
-      case op_malloc:
+        NEXT_OPCODE;
+      OPCASE(op_malloc):
         value = heap_alloc(inst[0].value);
         store_operand(inst[1].desttype, inst[1].value, value);
-        break;
-      case op_mfree:
+        NEXT_OPCODE;
+      OPCASE(op_mfree):
         heap_free(inst[0].value);
-        break;
+        NEXT_OPCODE;
 
-      case op_accelfunc:
+      OPCASE(op_accelfunc):
         accel_set_func(inst[0].value, inst[1].value);
-        break;
-      case op_accelparam:
+        NEXT_OPCODE;
+      OPCASE(op_accelparam):
         accel_set_param(inst[0].value, inst[1].value);
-        break;
+        NEXT_OPCODE;
 
 #ifdef FLOAT_SUPPORT
 
-      case op_numtof:
+      OPCASE(op_numtof):
         vals0 = inst[0].value;
         value = encode_float((gfloat32)vals0);
         store_operand(inst[1].desttype, inst[1].value, value);
-        break;
-      case op_ftonumz:
+        NEXT_OPCODE;
+      OPCASE(op_ftonumz):
         valf = decode_float(inst[0].value);
         if (!signbit(valf)) {
           if (isnan(valf) || isinf(valf) || (valf > 2147483647.0))
@@ -833,8 +1173,8 @@ void execute_loop()
             vals0 = (glsi32)(truncf(valf));
         }
         store_operand(inst[1].desttype, inst[1].value, vals0);
-        break;
-      case op_ftonumn:
+        NEXT_OPCODE;
+      OPCASE(op_ftonumn):
         valf = decode_float(inst[0].value);
         if (!signbit(valf)) {
           if (isnan(valf) || isinf(valf) || (valf > 2147483647.0))
@@ -849,34 +1189,34 @@ void execute_loop()
             vals0 = (glsi32)(roundf(valf));
         }
         store_operand(inst[1].desttype, inst[1].value, vals0);
-        break;
+        NEXT_OPCODE;
 
-      case op_fadd:
+      OPCASE(op_fadd):
         valf1 = decode_float(inst[0].value);
         valf2 = decode_float(inst[1].value);
         value = encode_float(valf1 + valf2);
         store_operand(inst[2].desttype, inst[2].value, value);
-        break;
-      case op_fsub:
+        NEXT_OPCODE;
+      OPCASE(op_fsub):
         valf1 = decode_float(inst[0].value);
         valf2 = decode_float(inst[1].value);
         value = encode_float(valf1 - valf2);
         store_operand(inst[2].desttype, inst[2].value, value);
-        break;
-      case op_fmul:
+        NEXT_OPCODE;
+      OPCASE(op_fmul):
         valf1 = decode_float(inst[0].value);
         valf2 = decode_float(inst[1].value);
         value = encode_float(valf1 * valf2);
         store_operand(inst[2].desttype, inst[2].value, value);
-        break;
-      case op_fdiv:
+        NEXT_OPCODE;
+      OPCASE(op_fdiv):
         valf1 = decode_float(inst[0].value);
         valf2 = decode_float(inst[1].value);
         value = encode_float(valf1 / valf2);
         store_operand(inst[2].desttype, inst[2].value, value);
-        break;
+        NEXT_OPCODE;
 
-      case op_fmod:
+      OPCASE(op_fmod):
         valf1 = decode_float(inst[0].value);
         valf2 = decode_float(inst[1].value);
         valf = fmodf(valf1, valf2);
@@ -890,14 +1230,14 @@ void execute_loop()
         }
         store_operand(inst[2].desttype, inst[2].value, val0);
         store_operand(inst[3].desttype, inst[3].value, val1);
-        break;
+        NEXT_OPCODE;
 
-      case op_floor:
+      OPCASE(op_floor):
         valf = decode_float(inst[0].value);
         value = encode_float(floorf(valf));
         store_operand(inst[1].desttype, inst[1].value, value);
-        break;
-      case op_ceil:
+        NEXT_OPCODE;
+      OPCASE(op_ceil):
         valf = decode_float(inst[0].value);
         value = encode_float(ceilf(valf));
         if (value == 0x0 || value == 0x80000000) {
@@ -907,68 +1247,68 @@ void execute_loop()
           value = inst[0].value & 0x80000000;
         }
         store_operand(inst[1].desttype, inst[1].value, value);
-        break;
+        NEXT_OPCODE;
 
-      case op_sqrt:
+      OPCASE(op_sqrt):
         valf = decode_float(inst[0].value);
         value = encode_float(sqrtf(valf));
         store_operand(inst[1].desttype, inst[1].value, value);
-        break;
-      case op_log:
+        NEXT_OPCODE;
+      OPCASE(op_log):
         valf = decode_float(inst[0].value);
         value = encode_float(logf(valf));
         store_operand(inst[1].desttype, inst[1].value, value);
-        break;
-      case op_exp:
+        NEXT_OPCODE;
+      OPCASE(op_exp):
         valf = decode_float(inst[0].value);
         value = encode_float(expf(valf));
         store_operand(inst[1].desttype, inst[1].value, value);
-        break;
-      case op_pow:
+        NEXT_OPCODE;
+      OPCASE(op_pow):
         valf1 = decode_float(inst[0].value);
         valf2 = decode_float(inst[1].value);
         value = encode_float(glulx_powf(valf1, valf2));
         store_operand(inst[2].desttype, inst[2].value, value);
-        break;
+        NEXT_OPCODE;
 
-      case op_sin:
+      OPCASE(op_sin):
         valf = decode_float(inst[0].value);
         value = encode_float(sinf(valf));
         store_operand(inst[1].desttype, inst[1].value, value);
-        break;
-      case op_cos:
+        NEXT_OPCODE;
+      OPCASE(op_cos):
         valf = decode_float(inst[0].value);
         value = encode_float(cosf(valf));
         store_operand(inst[1].desttype, inst[1].value, value);
-        break;
-      case op_tan:
+        NEXT_OPCODE;
+      OPCASE(op_tan):
         valf = decode_float(inst[0].value);
         value = encode_float(tanf(valf));
         store_operand(inst[1].desttype, inst[1].value, value);
-        break;
-      case op_asin:
+        NEXT_OPCODE;
+      OPCASE(op_asin):
         valf = decode_float(inst[0].value);
         value = encode_float(asinf(valf));
         store_operand(inst[1].desttype, inst[1].value, value);
-        break;
-      case op_acos:
+        NEXT_OPCODE;
+      OPCASE(op_acos):
         valf = decode_float(inst[0].value);
         value = encode_float(acosf(valf));
         store_operand(inst[1].desttype, inst[1].value, value);
-        break;
-      case op_atan:
+        NEXT_OPCODE;
+      OPCASE(op_atan):
         valf = decode_float(inst[0].value);
         value = encode_float(atanf(valf));
         store_operand(inst[1].desttype, inst[1].value, value);
-        break;
-      case op_atan2:
+        NEXT_OPCODE;
+      OPCASE(op_atan2):
         valf1 = decode_float(inst[0].value);
         valf2 = decode_float(inst[1].value);
         value = encode_float(atan2f(valf1, valf2));
         store_operand(inst[2].desttype, inst[2].value, value);
-        break;
+        NEXT_OPCODE;
 
-      case op_jisinf:
+      OPCASE(op_jisinf):
         /* Infinity is well-defined, so we don't bother to convert to
            float. */
         val0 = inst[0].value;
@@ -976,8 +1316,8 @@ void execute_loop()
           value = inst[1].value;
           goto PerformJump;
         }
-        break;
-      case op_jisnan:
+        NEXT_OPCODE;
+      OPCASE(op_jisnan):
         /* NaN is well-defined, so we don't bother to convert to
            float. */
         val0 = inst[0].value;
@@ -985,9 +1325,9 @@ void execute_loop()
           value = inst[1].value;
           goto PerformJump;
         }
-        break;
+        NEXT_OPCODE;
 
-      case op_jfeq:
+      OPCASE(op_jfeq):
         if ((inst[2].value & 0x7F800000) == 0x7F800000 && (inst[2].value & 0x007FFFFF) != 0) {
           /* The delta is NaN, which can never match. */
           val0 = 0;
@@ -1007,8 +1347,8 @@ void execute_loop()
           value = inst[3].value;
           goto PerformJump;
         }
-        break;
-      case op_jfne:
+        NEXT_OPCODE;
+      OPCASE(op_jfne):
         if ((inst[2].value & 0x7F800000) == 0x7F800000 && (inst[2].value & 0x007FFFFF) != 0) {
           /* The delta is NaN, which can never match. */
           val0 = 0;
@@ -1028,50 +1368,50 @@ void execute_loop()
           value = inst[3].value;
           goto PerformJump;
         }
-        break;
+        NEXT_OPCODE;
 
-      case op_jflt:
+      OPCASE(op_jflt):
         valf1 = decode_float(inst[0].value);
         valf2 = decode_float(inst[1].value);
         if (valf1 < valf2) {
           value = inst[2].value;
           goto PerformJump;
         }
-        break;
-      case op_jfgt:
+        NEXT_OPCODE;
+      OPCASE(op_jfgt):
         valf1 = decode_float(inst[0].value);
         valf2 = decode_float(inst[1].value);
         if (valf1 > valf2) {
           value = inst[2].value;
           goto PerformJump;
         }
-        break;
-      case op_jfle:
+        NEXT_OPCODE;
+      OPCASE(op_jfle):
         valf1 = decode_float(inst[0].value);
         valf2 = decode_float(inst[1].value);
         if (valf1 <= valf2) {
           value = inst[2].value;
           goto PerformJump;
         }
-        break;
-      case op_jfge:
+        NEXT_OPCODE;
+      OPCASE(op_jfge):
         valf1 = decode_float(inst[0].value);
         valf2 = decode_float(inst[1].value);
         if (valf1 >= valf2) {
           value = inst[2].value;
           goto PerformJump;
         }
-        break;
+        NEXT_OPCODE;
 
 #ifdef DOUBLE_SUPPORT   /* Inside FLOAT_SUPPORT! */
         
-      case op_numtod:
+      OPCASE(op_numtod):
         vals0 = inst[0].value;
         encode_double((gfloat64)vals0, &val0hi, &val0lo);
         store_operand(inst[1].desttype, inst[1].value, val0lo);
         store_operand(inst[2].desttype, inst[2].value, val0hi);
-        break;
-      case op_dtonumz:
+        NEXT_OPCODE;
+      OPCASE(op_dtonumz):
         vald = decode_double(inst[0].value, inst[1].value);
         if (!signbit(vald)) {
           if (isnan(vald) || isinf(vald) || (vald > 2147483647.0))
@@ -1086,8 +1426,8 @@ void execute_loop()
             vals0 = (glsi32)(trunc(vald));
         }
         store_operand(inst[2].desttype, inst[2].value, vals0);
-        break;
-      case op_dtonumn:
+        NEXT_OPCODE;
+      OPCASE(op_dtonumn):
         vald = decode_double(inst[0].value, inst[1].value);
         if (!signbit(vald)) {
           if (isnan(vald) || isinf(vald) || (vald > 2147483647.0))
@@ -1102,57 +1442,57 @@ void execute_loop()
             vals0 = (glsi32)(round(vald));
         }
         store_operand(inst[2].desttype, inst[2].value, vals0);
-        break;
-      case op_ftod:
+        NEXT_OPCODE;
+      OPCASE(op_ftod):
         valf = decode_float(inst[0].value);
         encode_double((gfloat64)valf, &val0hi, &val0lo);
         store_operand(inst[1].desttype, inst[1].value, val0lo);
         store_operand(inst[2].desttype, inst[2].value, val0hi);
-        break;
-      case op_dtof:
+        NEXT_OPCODE;
+      OPCASE(op_dtof):
         vald = decode_double(inst[0].value, inst[1].value);
         value = encode_float((gfloat32)vald);
         store_operand(inst[2].desttype, inst[2].value, value);
-        break;
+        NEXT_OPCODE;
         
-      case op_dadd:
+      OPCASE(op_dadd):
         vald1 = decode_double(inst[0].value, inst[1].value);
         vald2 = decode_double(inst[2].value, inst[3].value);
         encode_double(vald1 + vald2, &val0hi, &val0lo);
         store_operand(inst[4].desttype, inst[4].value, val0lo);
         store_operand(inst[5].desttype, inst[5].value, val0hi);
-        break;
-      case op_dsub:
+        NEXT_OPCODE;
+      OPCASE(op_dsub):
         vald1 = decode_double(inst[0].value, inst[1].value);
         vald2 = decode_double(inst[2].value, inst[3].value);
         encode_double(vald1 - vald2, &val0hi, &val0lo);
         store_operand(inst[4].desttype, inst[4].value, val0lo);
         store_operand(inst[5].desttype, inst[5].value, val0hi);
-        break;
-      case op_dmul:
+        NEXT_OPCODE;
+      OPCASE(op_dmul):
         vald1 = decode_double(inst[0].value, inst[1].value);
         vald2 = decode_double(inst[2].value, inst[3].value);
         encode_double(vald1 * vald2, &val0hi, &val0lo);
         store_operand(inst[4].desttype, inst[4].value, val0lo);
         store_operand(inst[5].desttype, inst[5].value, val0hi);
-        break;
-      case op_ddiv:
+        NEXT_OPCODE;
+      OPCASE(op_ddiv):
         vald1 = decode_double(inst[0].value, inst[1].value);
         vald2 = decode_double(inst[2].value, inst[3].value);
         encode_double(vald1 / vald2, &val0hi, &val0lo);
         store_operand(inst[4].desttype, inst[4].value, val0lo);
         store_operand(inst[5].desttype, inst[5].value, val0hi);
-        break;
+        NEXT_OPCODE;
         
-      case op_dmodr:
+      OPCASE(op_dmodr):
         vald1 = decode_double(inst[0].value, inst[1].value);
         vald2 = decode_double(inst[2].value, inst[3].value);
         vald = fmod(vald1, vald2);
         encode_double(vald, &val0hi, &val0lo);
         store_operand(inst[4].desttype, inst[4].value, val0lo);
         store_operand(inst[5].desttype, inst[5].value, val0hi);
-        break;
-      case op_dmodq:
+        NEXT_OPCODE;
+      OPCASE(op_dmodq):
         vald1 = decode_double(inst[0].value, inst[1].value);
         vald2 = decode_double(inst[2].value, inst[3].value);
         vald = fmod(vald1, vald2);
@@ -1166,93 +1506,93 @@ void execute_loop()
         }
         store_operand(inst[4].desttype, inst[4].value, val0lo);
         store_operand(inst[5].desttype, inst[5].value, val0hi);
-        break;
+        NEXT_OPCODE;
         
-      case op_dfloor:
+      OPCASE(op_dfloor):
         vald = decode_double(inst[0].value, inst[1].value);
         encode_double(floor(vald), &val0hi, &val0lo);
         store_operand(inst[2].desttype, inst[2].value, val0lo);
         store_operand(inst[3].desttype, inst[3].value, val0hi);
-        break;
-      case op_dceil:
+        NEXT_OPCODE;
+      OPCASE(op_dceil):
         vald = decode_double(inst[0].value, inst[1].value);
         encode_double(ceil(vald), &val0hi, &val0lo);
         store_operand(inst[2].desttype, inst[2].value, val0lo);
         store_operand(inst[3].desttype, inst[3].value, val0hi);
-        break;
+        NEXT_OPCODE;
         
-      case op_dsqrt:
+      OPCASE(op_dsqrt):
         vald = decode_double(inst[0].value, inst[1].value);
         encode_double(sqrt(vald), &val0hi, &val0lo);
         store_operand(inst[2].desttype, inst[2].value, val0lo);
         store_operand(inst[3].desttype, inst[3].value, val0hi);
-        break;
-      case op_dlog:
+        NEXT_OPCODE;
+      OPCASE(op_dlog):
         vald = decode_double(inst[0].value, inst[1].value);
         encode_double(log(vald), &val0hi, &val0lo);
         store_operand(inst[2].desttype, inst[2].value, val0lo);
         store_operand(inst[3].desttype, inst[3].value, val0hi);
-        break;
-      case op_dexp:
+        NEXT_OPCODE;
+      OPCASE(op_dexp):
         vald = decode_double(inst[0].value, inst[1].value);
         encode_double(exp(vald), &val0hi, &val0lo);
         store_operand(inst[2].desttype, inst[2].value, val0lo);
         store_operand(inst[3].desttype, inst[3].value, val0hi);
-        break;
-      case op_dpow:
+        NEXT_OPCODE;
+      OPCASE(op_dpow):
         vald1 = decode_double(inst[0].value, inst[1].value);
         vald2 = decode_double(inst[2].value, inst[3].value);
         encode_double(glulx_pow(vald1, vald2), &val0hi, &val0lo);
         store_operand(inst[4].desttype, inst[4].value, val0lo);
         store_operand(inst[5].desttype, inst[5].value, val0hi);
-        break;
+        NEXT_OPCODE;
 
-      case op_dsin:
+      OPCASE(op_dsin):
         vald = decode_double(inst[0].value, inst[1].value);
         encode_double(sin(vald), &val0hi, &val0lo);
         store_operand(inst[2].desttype, inst[2].value, val0lo);
         store_operand(inst[3].desttype, inst[3].value, val0hi);
-        break;
-      case op_dcos:
+        NEXT_OPCODE;
+      OPCASE(op_dcos):
         vald = decode_double(inst[0].value, inst[1].value);
         encode_double(cos(vald), &val0hi, &val0lo);
         store_operand(inst[2].desttype, inst[2].value, val0lo);
         store_operand(inst[3].desttype, inst[3].value, val0hi);
-        break;
-      case op_dtan:
+        NEXT_OPCODE;
+      OPCASE(op_dtan):
         vald = decode_double(inst[0].value, inst[1].value);
         encode_double(tan(vald), &val0hi, &val0lo);
         store_operand(inst[2].desttype, inst[2].value, val0lo);
         store_operand(inst[3].desttype, inst[3].value, val0hi);
-        break;
-      case op_dasin:
+        NEXT_OPCODE;
+      OPCASE(op_dasin):
         vald = decode_double(inst[0].value, inst[1].value);
         encode_double(asin(vald), &val0hi, &val0lo);
         store_operand(inst[2].desttype, inst[2].value, val0lo);
         store_operand(inst[3].desttype, inst[3].value, val0hi);
-        break;
-      case op_dacos:
+        NEXT_OPCODE;
+      OPCASE(op_dacos):
         vald = decode_double(inst[0].value, inst[1].value);
         encode_double(acos(vald), &val0hi, &val0lo);
         store_operand(inst[2].desttype, inst[2].value, val0lo);
         store_operand(inst[3].desttype, inst[3].value, val0hi);
-        break;
-      case op_datan:
+        NEXT_OPCODE;
+      OPCASE(op_datan):
         vald = decode_double(inst[0].value, inst[1].value);
         encode_double(atan(vald), &val0hi, &val0lo);
         store_operand(inst[2].desttype, inst[2].value, val0lo);
         store_operand(inst[3].desttype, inst[3].value, val0hi);
-        break;
-      case op_datan2:
+        NEXT_OPCODE;
+      OPCASE(op_datan2):
         vald1 = decode_double(inst[0].value, inst[1].value);
         vald2 = decode_double(inst[2].value, inst[3].value);
         vald = atan2(vald1, vald2);
         encode_double(vald, &val0hi, &val0lo);
         store_operand(inst[4].desttype, inst[4].value, val0lo);
         store_operand(inst[5].desttype, inst[5].value, val0hi);
-        break;
+        NEXT_OPCODE;
         
-      case op_jdisinf:
+      OPCASE(op_jdisinf):
         /* Infinity is well-defined, so we don't bother to convert to
            float. */
         val0 = inst[0].value;
@@ -1261,8 +1601,8 @@ void execute_loop()
           value = inst[2].value;
           goto PerformJump;
         }
-        break;
-      case op_jdisnan:
+        NEXT_OPCODE;
+      OPCASE(op_jdisnan):
         /* NaN is well-defined, so we don't bother to convert to
            float. */
         val0 = inst[0].value;
@@ -1271,9 +1611,9 @@ void execute_loop()
           value = inst[2].value;
           goto PerformJump;
         }
-        break;
+        NEXT_OPCODE;
 
-      case op_jdeq:
+      OPCASE(op_jdeq):
         if (DOUBLE_PAIR_ISNAN(inst[4].value, inst[5].value)) {
           /* The delta is NaN, which can never match. */
           val0 = 0;
@@ -1295,8 +1635,8 @@ void execute_loop()
           value = inst[6].value;
           goto PerformJump;
         }
-        break;
-      case op_jdne:
+        NEXT_OPCODE;
+      OPCASE(op_jdne):
         if (DOUBLE_PAIR_ISNAN(inst[4].value, inst[5].value)) {
           /* The delta is NaN, which can never match. */
           val0 = 0;
@@ -1318,40 +1658,40 @@ void execute_loop()
           value = inst[6].value;
           goto PerformJump;
         }
-        break;
+        NEXT_OPCODE;
         
-      case op_jdlt:
+      OPCASE(op_jdlt):
         vald1 = decode_double(inst[0].value, inst[1].value);
         vald2 = decode_double(inst[2].value, inst[3].value);
         if (vald1 < vald2) {
           value = inst[4].value;
           goto PerformJump;
         }
-        break;
-      case op_jdgt:
+        NEXT_OPCODE;
+      OPCASE(op_jdgt):
         vald1 = decode_double(inst[0].value, inst[1].value);
         vald2 = decode_double(inst[2].value, inst[3].value);
         if (vald1 > vald2) {
           value = inst[4].value;
           goto PerformJump;
         }
-        break;
-      case op_jdle:
+        NEXT_OPCODE;
+      OPCASE(op_jdle):
         vald1 = decode_double(inst[0].value, inst[1].value);
         vald2 = decode_double(inst[2].value, inst[3].value);
         if (vald1 <= vald2) {
           value = inst[4].value;
           goto PerformJump;
         }
-        break;
-      case op_jdge:
+        NEXT_OPCODE;
+      OPCASE(op_jdge):
         vald1 = decode_double(inst[0].value, inst[1].value);
         vald2 = decode_double(inst[2].value, inst[3].value);
         if (vald1 >= vald2) {
           value = inst[4].value;
           goto PerformJump;
         }
-        break;
+        NEXT_OPCODE;
 
 #endif /* DOUBLE_SUPPORT */
         
@@ -1371,3 +1711,72 @@ void execute_loop()
   debugger_handle_quit();
 #endif /* VM_DEBUGGER */
 }
+
+/* perform_divide(), perform_remainder():
+   Signed division and remainder, for the @div and @mod opcodes. These
+   are shared by the interpreter and precompiled story code (aot.c), so
+   the two agree on every special case.
+*/
+glui32 perform_divide(glui32 dividend, glui32 divisor)
+{
+  glsi32 vals0 = dividend;
+  glsi32 vals1 = divisor;
+  glui32 val0, val1;
+
+  if (vals1 == 0)
+    fatal_error("Division by zero.");
+  if (vals1 == -1 && (glui32)vals0 == 0x80000000)
+    fatal_error("Division overflow.");
+  /* Since C doesn't guarantee the results of division of negative
+     numbers, we carefully convert everything to positive values
+     first. They have to be unsigned values, too, otherwise the
+     0x80000000 case goes wonky. */
+  if (vals0 < 0) {
+    val0 = (-(glui32)vals0);
+    if (vals1 < 0) {
+      val1 = (-(glui32)vals1);
+      return val0 / val1;
+    }
+    else {
+      val1 = vals1;
+      return -(val0 / val1);
+    }
+  }
+  else {
+    val0 = vals0;
+    if (vals1 < 0) {
+      val1 = (-(glui32)vals1);
+      return -(val0 / val1);
+    }
+    else {
+      val1 = vals1;
+      return val0 / val1;
+    }
+  }
+}
+
+glui32 perform_remainder(glui32 dividend, glui32 divisor)
+{
+  glsi32 vals0 = dividend;
+  glsi32 vals1 = divisor;
+  glui32 val0, val1;
+
+  if (vals1 == 0)
+    fatal_error("Division by zero doing remainder.");
+  if (vals1 == -1 && (glui32)vals0 == 0x80000000)
+    fatal_error("Division overflow doing remainder.");
+  if (vals1 < 0) {
+    val1 = -(glui32)vals1;
+  }
+  else {
+    val1 = vals1;
+  }
+  if (vals0 < 0) {
+    val0 = (-(glui32)vals0);
+    return -(val0 % val1);
+  }
+  else {
+    val0 = vals0;
+    return val0 % val1;
+  }
+}
@@ -3,9 +3,175 @@
     http://eblong.com/zarf/glulx/index.html
 */
 
+#include <string.h>
 #include "glk.h"
 #include "glulxe.h"
 
+/* The longest locals-format list (as written into the call frame) that
+   a decoded header keeps a copy of. Inform functions nearly always have
+   a single (4, N) entry, which is four bytes with the terminator. */
+#define FUNC_FORMAT_SIZE (16)
+
+/* A decoded function header: what enter_function() learns from the
+   function's type byte and locals-format list, and its acceleration
+   status. This doubles as a template for the function's call frame. */
+typedef struct funcheader_struct {
+  glui32 funcaddr;
+  acceleration_func accelfunc;
+  int functype;
+  int formatbytes; /* length of the format list in memory (with the
+                      terminating zero pair) */
+  int formatlen; /* length of the format list in the call frame (padded) */
+  int locallen; /* length of the locals (padded) */
+  int allfour; /* true if every local is four bytes */
+  unsigned char format[FUNC_FORMAT_SIZE]; /* the format list as it appears
+                                             in the call frame, if it fits */
+} funcheader_t;
+
+static void decode_function_header(glui32 funcaddr, funcheader_t *hdr);
+static funcheader_t *get_function_header(glui32 funcaddr, funcheader_t *buf);
+static void build_function_frame(funcheader_t *hdr, glui32 argc,
+  glui32 *argv);
+
+#ifdef CALL_CACHE
+
+/* The call cache is a direct-mapped table, indexed by the low bits of
+   the address of the call instruction. Each entry remembers the last
+   function called from that site, with its decoded header. Behind it
+   is the function cache, another direct-mapped table of decoded
+   headers indexed by function address, which serves calls from sites
+   that are not in the call cache (or call a different function each
+   time).
+
+   Only functions whose header lies entirely in ROM are cached; the
+   acceleration status is refreshed by flushing both tables whenever
+   @accelfunc changes it. */
+#define CALL_CACHE_SIZE (2048)
+#define FUNC_CACHE_SIZE (1024)
+
+typedef struct callsite_struct {
+  glui32 callpc;
+  funcheader_t hdr;
+} callsite_t;
+
+static callsite_t *callcache = NULL;
+static funcheader_t *funccache = NULL;
+
+#ifdef CACHE_STATS
+glui32 call_cache_hits = 0;
+glui32 call_cache_misses = 0;
+glui32 func_cache_hits = 0;
+glui32 func_cache_misses = 0;
+#define cache_stat_count(counter)  ((counter)++)
+#else /* CACHE_STATS */
+#define cache_stat_count(counter)  (0)
+#endif /* CACHE_STATS */
+
+/* init_call_cache():
+   Allocate the call and function caches. If this fails, calls simply
+   go uncached.
+*/
+void init_call_cache()
+{
+  if (!callcache) {
+    callcache = (callsite_t *)glulx_malloc(CALL_CACHE_SIZE
+      * sizeof(callsite_t));
+    if (!callcache)
+      return;
+  }
+  if (!funccache) {
+    funccache = (funcheader_t *)glulx_malloc(FUNC_CACHE_SIZE
+      * sizeof(funcheader_t));
+    if (!funccache) {
+      final_call_cache();
+      return;
+    }
+  }
+  flush_call_cache();
+}
+
+/* final_call_cache():
+   Deallocate the call and function caches.
+*/
+void final_call_cache()
+{
+  if (callcache) {
+    glulx_free(callcache);
+    callcache = NULL;
+  }
+  if (funccache) {
+    glulx_free(funccache);
+    funccache = NULL;
+  }
+}
+
+/* flush_call_cache():
+   Forget every cached call site and function header. This must be
+   called whenever the acceleration table changes.
+*/
+void flush_call_cache()
+{
+  int ix;
+
+  if (callcache) {
+    for (ix=0; ix<CALL_CACHE_SIZE; ix++)
+      callcache[ix].callpc = 0;
+  }
+  /* No function lives at address zero, so that marks an empty entry. */
+  if (funccache) {
+    for (ix=0; ix<FUNC_CACHE_SIZE; ix++)
+      funccache[ix].funcaddr = 0;
+  }
+}
+
+/* header_is_cacheable():
+   Whether a decoded header can be kept: that is, whether it lies
+   entirely in ROM, where it cannot change. (An accelerated function's
+   header is never read, so it is always cacheable.)
+*/
+static int header_is_cacheable(funcheader_t *hdr)
+{
+  if (hdr->accelfunc)
+    return TRUE;
+  return (hdr->funcaddr < ramstart 
+    && ramstart - hdr->funcaddr > hdr->formatbytes);
+}
+
+/* enter_function_from():
+   The same as enter_function(), for a call made by the instruction at
+   callpc. If that instruction last called the same function, the
+   decoded header is reused.
+*/
+void enter_function_from(glui32 callpc, glui32 funcaddr, glui32 argc,
+  glui32 *argv)
+{
+  callsite_t *site;
+  funcheader_t buf;
+  funcheader_t *hdr;
+
+  if (!callcache) {
+    enter_function(funcaddr, argc, argv);
+    return;
+  }
+
+  site = &callcache[callpc & (CALL_CACHE_SIZE-1)];
+  if (site->callpc == callpc && site->hdr.funcaddr == funcaddr) {
+    cache_stat_count(call_cache_hits);
+    build_function_frame(&site->hdr, argc, argv);
+    return;
+  }
+
+  cache_stat_count(call_cache_misses);
+  hdr = get_function_header(funcaddr, &buf);
+  if (header_is_cacheable(hdr)) {
+    site->callpc = callpc;
+    site->hdr = *hdr;
+  }
+  build_function_frame(hdr, argc, argv);
+}
+
+#endif /* CALL_CACHE */
+
 /* enter_function():
    This writes a new call frame onto the stack, at stackptr. It leaves
    frameptr pointing to the frame (ie, the original stackptr value.) 
@@ -14,24 +180,63 @@
 */
 void enter_function(glui32 funcaddr, glui32 argc, glui32 *argv)
 {
-  int ix, jx;
-  acceleration_func accelfunc;
+  funcheader_t buf;
+
+  build_function_frame(get_function_header(funcaddr, &buf), argc, argv);
+}
+
+/* get_function_header():
+   Return the decoded header for the function at funcaddr. This comes
+   from the function cache if possible; otherwise the header is decoded
+   into buf (and cached, if it can be).
+*/
+static funcheader_t *get_function_header(glui32 funcaddr, funcheader_t *buf)
+{
+#ifdef CALL_CACHE
+  funcheader_t *ent;
+
+  if (funccache) {
+    ent = &funccache[funcaddr & (FUNC_CACHE_SIZE-1)];
+    if (ent->funcaddr == funcaddr) {
+      cache_stat_count(func_cache_hits);
+      return ent;
+    }
+    cache_stat_count(func_cache_misses);
+    decode_function_header(funcaddr, buf);
+    if (header_is_cacheable(buf)) {
+      *ent = *buf;
+      return ent;
+    }
+    return buf;
+  }
+#endif /* CALL_CACHE */
+
+  decode_function_header(funcaddr, buf);
+  return buf;
+}
+
+/* decode_function_header():
+   Look up the function's acceleration status and, if it is not
+   accelerated, check its type byte and work out the layout of its
+   call frame. 
+*/
+static void decode_function_header(glui32 funcaddr, funcheader_t *hdr)
+{
+  int ix;
   int locallen;
   int functype;
-  glui32 modeaddr, opaddr, val;
   int loctype, locnum;
   glui32 addr = funcaddr;
 
-  accelfunc = accel_get_func(addr);
-  if (accelfunc) {
-    profile_in(addr, stackptr, TRUE);
-    val = accelfunc(argc, argv);
-    profile_out(stackptr);
-    pop_callstub(val);
+  hdr->funcaddr = funcaddr;
+  hdr->accelfunc = accel_get_func(addr);
+  hdr->functype = 0;
+  hdr->formatbytes = 0;
+  hdr->formatlen = 0;
+  hdr->locallen = 0;
+  hdr->allfour = TRUE;
+  if (hdr->accelfunc)
     return;
-  }
-    
-  profile_in(addr, stackptr, FALSE);
 
   /* Check the Glulx type identifier byte. */
   functype = Mem1(addr);
@@ -43,12 +248,8 @@ void enter_function(glui32 funcaddr, glui32 argc, glui32 *argv)
   }
   addr++;
 
-  /* Bump the frameptr to the top. */
-  frameptr = stackptr;
-
-  /* Go through the function's locals-format list, copying it to the
-     call frame. At the same time, we work out how much space the locals
-     will actually take up. (Including padding.) */
+  /* Go through the function's locals-format list, and work out how
+     much space the locals will actually take up. (Including padding.) */
   ix = 0;
   locallen = 0;
   while (1) {
@@ -59,23 +260,28 @@ void enter_function(glui32 funcaddr, glui32 argc, glui32 *argv)
     locnum = Mem1(addr);
     addr++;
 
-    /* Copy them into the call frame. */
-    StkW1(frameptr+8+2*ix, loctype);
-    StkW1(frameptr+8+2*ix+1, locnum);
+    /* Copy them into the template, if there's room. (There's room
+       for the padding pair too, since FUNC_FORMAT_SIZE is a multiple
+       of four.) */
+    if (2*ix+2 <= FUNC_FORMAT_SIZE) {
+      hdr->format[2*ix] = loctype;
+      hdr->format[2*ix+1] = locnum;
+    }
     ix++;
 
     /* If the type is zero, we're done, except possibly for two more
        zero bytes in the call frame (to ensure 4-byte alignment.) */
     if (loctype == 0) {
-      /* Make sure ix is even. */
-      if (ix & 1) {
-        StkW1(frameptr+8+2*ix, 0);
-        StkW1(frameptr+8+2*ix+1, 0);
-        ix++;
+      if ((ix & 1) && 2*ix+2 <= FUNC_FORMAT_SIZE) {
+        hdr->format[2*ix] = 0;
+        hdr->format[2*ix+1] = 0;
       }
       break;
     }
 
+    if (loctype != 4)
+      hdr->allfour = FALSE;
+
     /* Pad to 4-byte or 2-byte alignment if these locals are 4 or 2
        bytes long. */
     if (loctype == 4) {
@@ -101,29 +307,76 @@ void enter_function(glui32 funcaddr, glui32 argc, glui32 *argv)
   while (locallen & 3)
     locallen++;
 
-  /* We now know how long the locals-frame and locals segments are. */
-  localsbase = frameptr+8+2*ix;
+  hdr->functype = functype;
+  hdr->formatbytes = 2*ix;
+  hdr->formatlen = 2*(ix + (ix & 1));
+  hdr->locallen = locallen;
+}
+
+/* build_function_frame():
+   Enter a function whose header has been decoded: either call its
+   accelerated version, or push its call frame and arguments and set
+   the PC to its first instruction.
+*/
+static void build_function_frame(funcheader_t *hdr, glui32 argc,
+  glui32 *argv)
+{
+  int ix;
+  int formatlen = hdr->formatlen;
+  int locallen = hdr->locallen;
+  glui32 modeaddr, opaddr, val;
+  int loctype, locnum;
+  glui32 addr = hdr->funcaddr;
+
+  if (hdr->accelfunc) {
+    profile_in(addr, stackptr, TRUE);
+    val = hdr->accelfunc(argc, argv);
+    profile_out(stackptr);
+    pop_callstub(val);
+    return;
+  }
+    
+  profile_in(addr, stackptr, FALSE);
+  addr++;
+
+  /* Bump the frameptr to the top. We already know how long the
+     locals-frame and locals segments are. */
+  frameptr = stackptr;
+  localsbase = frameptr+8+formatlen;
   valstackbase = localsbase+locallen;
 
   /* Test for stack overflow. */
-  /* This really isn't good enough; if the format list overflowed the
-     stack, we've already written outside the stack array. */
   if (valstackbase >= stacksize)
     fatal_error("Stack overflow in function call.");
 
-  /* Fill in the beginning of the stack frame. */
-  StkW4(frameptr+4, 8+2*ix);
-  StkW4(frameptr, 8+2*ix+locallen);
+  /* Fill in the beginning of the stack frame, and copy the
+     locals-format list into it. */
+  StkW4(frameptr+4, 8+formatlen);
+  StkW4(frameptr, 8+formatlen+locallen);
+  if (formatlen <= FUNC_FORMAT_SIZE) {
+    memcpy(stack+frameptr+8, hdr->format, formatlen);
+  }
+  else {
+    for (ix=0; ix<hdr->formatbytes; ix++)
+      StkW1(frameptr+8+ix, Mem1(addr+ix));
+    for (; ix<formatlen; ix++)
+      StkW1(frameptr+8+ix, 0);
+  }
 
   /* Set the stackptr and PC. */
   stackptr = valstackbase;
-  pc = addr;
+  pc = addr + hdr->formatbytes;
+#ifdef JIT_COMPILER
+  jit_trigger = TRUE;
+#endif /* JIT_COMPILER */
+#ifdef PRECOMPILED_STORY
+  aot_trigger = TRUE;
+#endif /* PRECOMPILED_STORY */
 
   /* Zero out all the locals. */
-  for (jx=0; jx<locallen; jx++) 
-    StkW1(localsbase+jx, 0);
+  memset(stack+localsbase, 0, locallen);
 
-  if (functype == 0xC0) {
+  if (hdr->functype == 0xC0) {
     /* Push the function arguments on the stack. The locals have already
        been zeroed. */
     if (stackptr+4*(argc+1) >= stacksize)
@@ -136,6 +389,14 @@ void enter_function(glui32 funcaddr, glui32 argc, glui32 *argv)
     StkW4(stackptr, argc);
     stackptr += 4;
   }
+  else if (hdr->allfour) {
+    /* All the locals are four bytes, with no padding, so the arguments
+       go in one after another. */
+    if (argc > locallen / 4)
+      argc = locallen / 4;
+    for (ix=0; ix<argc; ix++)
+      StkW4(localsbase+4*ix, argv[ix]);
+  }
   else {
     /* Copy in function arguments. This is a bit gross, since we have to
        follow the locals format. If there are fewer arguments than locals,
@@ -187,7 +448,7 @@ void enter_function(glui32 funcaddr, glui32 argc, glui32 *argv)
 
   /* If the debugger is compiled in, check for a breakpoint on this
      function. (Checking the function address, not the starting PC.) */
-  debugger_check_func_breakpoint(funcaddr);
+  debugger_check_func_breakpoint(hdr->funcaddr);
 }
 
 /* leave_function():
@@ -207,6 +468,10 @@ void push_callstub(glui32 desttype, glui32 destaddr)
 {
   if (stackptr+16 > stacksize)
     fatal_error("Stack overflow in callstub.");
+  /* Desttype 4 is our own shorthand for a verified memory address;
+     the stub must hold the real desttype, since it may be saved. */
+  if (desttype == 4)
+    desttype = 1;
   StkW4(stackptr+0, desttype);
   StkW4(stackptr+4, destaddr);
   StkW4(stackptr+8, pc);
@@ -235,6 +500,9 @@ void pop_callstub(glui32 returnvalue)
 
   pc = newpc;
   frameptr = newframeptr;
+#ifdef PRECOMPILED_STORY
+  aot_trigger = TRUE;
+#endif /* PRECOMPILED_STORY */
 
   /* Recompute valstackbase and localsbase */
   valstackbase = frameptr + Stk4(frameptr);
@@ -270,12 +538,22 @@ void pop_callstub(glui32 returnvalue)
     stream_string(pc, 0xE2, destaddr); 
     break;
 
-  default:
+  case 0:
+  case 1:
+  case 2:
+  case 3:
     /* We're back in the original frame, so we can store the returnvalue. 
        (If we tried to do this before resetting frameptr, a result
        destination on the stack would go astray.) */
     store_operand(desttype, destaddr, returnvalue);
     break;
+
+  default:
+    /* Desttype 4 (a verified address) is never pushed, so a stub that
+       has one came from a forged save file or a stray @throw. Its
+       address is unchecked; refuse it along with the unknown ones. */
+    fatal_error("Unknown destination type in call stub.");
+    break;
   }
 }
 
@@ -230,6 +230,10 @@ glui32 perform_glk(glui32 funcnum, glui32 numargs, glui32 *arglist)
 {
   glui32 retval = 0;
 
+  /* Buffered output must reach the current stream before the game does
+     anything else with Glk. */
+  stream_flush();
+
   switch (funcnum) {
     /* To speed life up, we implement commonly-used Glk functions
        directly -- instead of bothering with the whole prototype 
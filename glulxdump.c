@@ -340,6 +340,8 @@ static opcode_t opcodes_table[] =
   { (uchar *) "jisinf",     0x1C9,  Br, GOP_Float, 2 },
 };
 
+#define NUM_OPCODES (sizeof(opcodes_table) / sizeof(opcode_t))
+
 static int read_header(FILE *fl);
 static int findopcode(int opnum);
 void print_string(glui32 pos);
@@ -349,6 +351,8 @@ void dump_objs(void);
 void dump_action_table(void);
 void dump_dict_table(void);
 void dump_grammar_table(void);
+void dump_pairs(void);
+void dump_c(void);
 
 int dumpfuncs = FALSE;
 int dumpstrings = FALSE;
@@ -357,6 +361,8 @@ int dumpheader = FALSE;
 int dumpactiontbl = FALSE;
 int dumpdicttbl = FALSE;
 int dumpgrammartbl = FALSE;
+int dumppairs = FALSE;
+int dumpc = FALSE;
 glui32 posactiontbl = 0;
 glui32 posdicttbl = 0;
 glui32 posgrammartbl = 0;
@@ -392,6 +398,10 @@ int main(int argc, char *argv[])
       dumpobjs = TRUE;
     else if (!strcmp(argv[ix], "-h"))
       dumpheader = TRUE;
+    else if (!strcmp(argv[ix], "-p"))
+      dumppairs = TRUE;
+    else if (!strcmp(argv[ix], "-c"))
+      dumpc = TRUE;
     else if (!strcmp(argv[ix], "-a")) {
       ix++;
       if (ix >= argc || (val = strtol(argv[ix], NULL, 16)) == 0) {
@@ -429,7 +439,8 @@ int main(int argc, char *argv[])
   }
 
   if (!dumpfuncs && !dumpstrings && !dumpobjs && !dumpheader 
-    && !dumpactiontbl && !dumpdicttbl && !dumpgrammartbl) {
+    && !dumpactiontbl && !dumpdicttbl && !dumpgrammartbl && !dumppairs
+    && !dumpc) {
     dumpfuncs = TRUE;
     dumpstrings = TRUE;
     dumpobjs = TRUE;
@@ -482,6 +493,10 @@ int main(int argc, char *argv[])
     dump_dict_table();
   if (dumpgrammartbl) 
     dump_grammar_table();
+  if (dumppairs)
+    dump_pairs();
+  if (dumpc)
+    dump_c();
 
   exit(0);
 }
@@ -708,6 +723,8 @@ void dump_ram()
 
 static int findopcode(int opnum)
 {
+  int ix;
+
   switch (opnum) {
   case op_nop: return nop_gc;
   case op_add: return add_gc;
@@ -771,11 +788,691 @@ static int findopcode(int opnum)
   case op_protect: return protect_gc;
   case op_glk: return glk_gc;
   default: 
+    for (ix=0; ix<NUM_OPCODES; ix++) {
+      if (opcodes_table[ix].code == opnum)
+        return ix;
+    }
     printf("Unknown opcode %02x\n", opnum);
     return nop_gc;
   }
 }
 
+/* The superinstruction report. We count every pair of consecutive
+   instructions in every function, and also how many of those pairs
+   the interpreter would fuse. (This must match fuse_instruction() in
+   operand.c.) */
+
+typedef struct instinfo_struct {
+  int opcode;
+  int modes[16];
+  glui32 values[16];
+} instinfo_t;
+
+static glui32 read_opcode(glui32 pos, int *opcode);
+static glui32 decode_inst(glui32 pos, instinfo_t *inst, int *index);
+static int pair_is_fused(instinfo_t *first, instinfo_t *second);
+
+/* These are indexed by opcodes_table position. */
+static long paircounts[NUM_OPCODES][NUM_OPCODES];
+static long pairfused[NUM_OPCODES][NUM_OPCODES];
+
+void dump_pairs()
+{
+  glui32 pos;
+  unsigned char ch;
+  int ix, jx, count;
+  int previndex, curindex;
+  instinfo_t insts[2];
+  instinfo_t *previnst, *curinst;
+  long total = 0, totalfused = 0;
+
+  pos = 4 * (9+5);
+
+  /* Walk ROM the same way dump_ram() does. */
+  while (pos < ramstart) {
+    ch = Mem1(pos);
+    
+    if (ch == 0xE0) {
+      pos++;
+      while (Mem1(pos) != '\0')
+        pos++;
+      pos++;
+    }
+    else if (ch == 0xC0 || ch == 0xC1) {
+      pos++;
+      while (Mem1(pos) != 0)
+        pos += 2;
+      pos += 2;
+
+      previnst = NULL;
+      previndex = 0;
+      jx = 0;
+      while (pos < ramstart) {
+        /* A zero byte is more likely padding than a @nop. */
+        ch = Mem1(pos);
+        if (ch == 0xC0 || ch == 0xC1 || ch == 0xE0 || ch == 0)
+          break;
+        curinst = &insts[jx];
+        jx = 1-jx;
+        pos = decode_inst(pos, curinst, &curindex);
+        if (previnst) {
+          total++;
+          paircounts[previndex][curindex]++;
+          if (pair_is_fused(previnst, curinst)) {
+            totalfused++;
+            pairfused[previndex][curindex]++;
+          }
+        }
+        /* Execution never falls through a return or jump, so that
+           doesn't start a pair. */
+        if (opcodes_table[curindex].flags & Rf) {
+          previnst = NULL;
+        }
+        else {
+          previnst = curinst;
+          previndex = curindex;
+        }
+      }
+    }
+    else {
+      pos++;
+    }
+  }
+
+  printf("Instruction pairs: %ld (%ld fused)\n", total, totalfused);
+  printf("Most common pairs:\n");
+  printf("  %8s %8s  %s\n", "count", "fused", "pair");
+
+  for (count=0; count<40; count++) {
+    int bestix = -1, bestjx = -1;
+    long best = 0;
+    for (ix=0; ix<NUM_OPCODES; ix++) {
+      for (jx=0; jx<NUM_OPCODES; jx++) {
+        if (paircounts[ix][jx] > best) {
+          best = paircounts[ix][jx];
+          bestix = ix;
+          bestjx = jx;
+        }
+      }
+    }
+    if (bestix < 0)
+      break;
+    printf("  %8ld %8ld  %s %s\n", best, pairfused[bestix][bestjx],
+      opcodes_table[bestix].name, opcodes_table[bestjx].name);
+    paircounts[bestix][bestjx] = 0;
+  }
+}
+
+/* Read the opcode number at pos, and return the position after it. */
+static glui32 read_opcode(glui32 pos, int *opcode)
+{
+  unsigned char ch;
+  int val;
+
+  ch = Mem1(pos); pos++;
+  if ((ch & 0x80) == 0) {
+    val = ch;
+  }
+  else if ((ch & 0x40) == 0) {
+    val = (ch & 0x7F);
+    val = (val << 8) | Mem1(pos); pos++;
+  }
+  else {
+    val = (ch & 0x3F);
+    val = (val << 8) | Mem1(pos); pos++;
+    val = (val << 8) | Mem1(pos); pos++;
+    val = (val << 8) | Mem1(pos); pos++;
+  }
+  *opcode = val;
+  return pos;
+}
+
+/* Decode the instruction at pos, and return the position after it. */
+static glui32 decode_inst(glui32 pos, instinfo_t *inst, int *index)
+{
+  int opcode, jx;
+  unsigned char ch;
+  opcode_t *opco;
+
+  pos = read_opcode(pos, &opcode);
+  *index = findopcode(opcode);
+  opco = &opcodes_table[*index];
+  inst->opcode = opcode;
+
+  for (jx=0; jx<opco->no; jx+=2) {
+    ch = Mem1(pos); pos++;
+    inst->modes[jx+0] = (ch & 0x0F);
+    inst->modes[jx+1] = ((ch >> 4) & 0x0F);
+  }
+
+  for (jx=0; jx<opco->no; jx++) {
+    glui32 val = 0;
+    switch (inst->modes[jx]) {
+    case 1: case 5: case 9: case 13:
+      val = Mem1(pos);
+      if (inst->modes[jx] == 1 && (val & 0x80))
+        val |= 0xFFFFFF00;
+      pos += 1;
+      break;
+    case 2: case 6: case 10: case 14:
+      val = Mem2(pos);
+      if (inst->modes[jx] == 2 && (val & 0x8000))
+        val |= 0xFFFF0000;
+      pos += 2;
+      break;
+    case 3: case 7: case 11: case 15:
+      val = Mem4(pos);
+      pos += 4;
+      break;
+    }
+    inst->values[jx] = val;
+  }
+
+  return pos;
+}
+
+#define MODE_IS_CONST(mode) ((mode) <= 3)
+#define MODE_IS_LOCAL(mode) ((mode) >= 9 && (mode) <= 11)
+
+static int pair_is_fused(instinfo_t *first, instinfo_t *second)
+{
+  switch (first->opcode) {
+  case op_aload:
+  case op_aloads:
+  case op_aloadb:
+    if (first->modes[2] != 8 || second->modes[0] != 8)
+      return FALSE;
+    switch (second->opcode) {
+    case op_jz:
+    case op_jnz:
+      return MODE_IS_CONST(second->modes[1]);
+    case op_jeq:
+    case op_jne:
+      return (MODE_IS_CONST(second->modes[2])
+        && (MODE_IS_CONST(second->modes[1]) 
+          || MODE_IS_LOCAL(second->modes[1])));
+    }
+    return FALSE;
+  case op_copy:
+    if (second->opcode != op_add)
+      return FALSE;
+    return (MODE_IS_LOCAL(first->modes[1]) 
+      && MODE_IS_LOCAL(second->modes[0])
+      && first->values[1] == second->values[0]
+      && (MODE_IS_CONST(second->modes[1]) 
+        || MODE_IS_LOCAL(second->modes[1])));
+  }
+  return FALSE;
+}
+
+/* The C translator. Every function in ROM becomes a C function, which
+   runs the function's code from a given entry point and returns the
+   address of the next instruction for the interpreter to execute. (See
+   aot.c for how these are called.) Only the core of the instruction
+   set is translated: arithmetic, copy, sign extension, array loads and
+   stores, and the branches. Any other instruction (@call, @return,
+   @glk, @streamstr, and so on) is left to the interpreter, and the
+   instruction after it becomes an entry point, so that the translated
+   code can pick up again from there.
+
+   The generated code uses the interpreter's own memory and stack
+   macros, so it makes the same checks and reports the same errors. */
+
+typedef struct cinst_struct {
+  glui32 addr;
+  glui32 next;
+  int index;
+  int translatable;
+  int entry; /* The function can be entered here */
+  instinfo_t inst;
+} cinst_t;
+
+typedef struct cfunc_struct {
+  glui32 start;
+  glui32 end;
+} cfunc_t;
+
+static cinst_t *cinsts = NULL;
+static int cinsts_size = 0;
+static int cinsts_count = 0;
+
+static int c_inst_translatable(cinst_t *ci);
+static int c_find_inst(glui32 addr);
+static glui32 c_branch_target(cinst_t *ci);
+static void c_emit_function(glui32 start, glui32 end);
+static void c_emit_inst(cinst_t *ci);
+static void c_emit_load(cinst_t *ci, int jx, int argsize, char *dest);
+static void c_emit_store(cinst_t *ci, int jx, int size, char *src);
+static void c_emit_branch(cinst_t *ci, char *cond);
+
+void dump_c()
+{
+  glui32 pos, start;
+  unsigned char ch;
+  int ix, opcode;
+  cinst_t *ci;
+  cfunc_t *cfuncs = NULL;
+  int cfuncs_size = 0;
+  int cfuncs_count = 0;
+
+  printf("/* Precompiled story, generated by \"glulxdump -c\". */\n\n");
+  printf("#include \"glk.h\"\n");
+  printf("#include \"glulxe.h\"\n\n");
+  printf("#ifdef PRECOMPILED_STORY\n\n");
+  printf("/* How many backward branches a function may take before it\n");
+  printf("   returns to the interpreter. */\n");
+  printf("#define AOT_LOOP_BUDGET (0x4000)\n\n");
+  printf("#define AOT_POP(v)  \\\n");
+  printf("  do { if (stackptr < valstackbase+4) fatal_error(\"Stack underflow in operand.\"); \\\n");
+  printf("    stackptr -= 4; (v) = Stk4(stackptr); } while (0)\n");
+  printf("#define AOT_PUSH(v)  \\\n");
+  printf("  do { if (stackptr+4 > stacksize) fatal_error(\"Stack overflow in store operand.\"); \\\n");
+  printf("    StkW4(stackptr, (v)); stackptr += 4; } while (0)\n\n");
+
+  pos = 4 * (9+5);
+
+  /* Walk ROM the same way dump_ram() does. */
+  while (pos < ramstart) {
+    ch = Mem1(pos);
+    
+    if (ch == 0xE0) {
+      pos++;
+      while (Mem1(pos) != '\0')
+        pos++;
+      pos++;
+    }
+    else if (ch == 0xC0 || ch == 0xC1) {
+      pos++;
+      while (Mem1(pos) != 0)
+        pos += 2;
+      pos += 2;
+      start = pos;
+
+      cinsts_count = 0;
+      while (pos < ramstart) {
+        /* A zero byte is more likely padding than a @nop. */
+        ch = Mem1(pos);
+        if (ch == 0xC0 || ch == 0xC1 || ch == 0xE0 || ch == 0)
+          break;
+        /* We can't go on past an opcode we don't know the length of. */
+        read_opcode(pos, &opcode);
+        for (ix=0; ix<NUM_OPCODES; ix++) {
+          if (opcodes_table[ix].code == opcode)
+            break;
+        }
+        if (ix == NUM_OPCODES)
+          break;
+        if (cinsts_count >= cinsts_size) {
+          cinsts_size = (cinsts_size ? 2*cinsts_size : 256);
+          cinsts = (cinst_t *)realloc(cinsts, cinsts_size * sizeof(cinst_t));
+          if (!cinsts) {
+            fprintf(stderr, "Out of memory.\n");
+            exit(1);
+          }
+        }
+        ci = &cinsts[cinsts_count];
+        ci->addr = pos;
+        ci->next = decode_inst(pos, &ci->inst, &ci->index);
+        if (ci->next > ramstart)
+          break;
+        pos = ci->next;
+        cinsts_count++;
+      }
+
+      if (cinsts_count) {
+        c_emit_function(start, pos);
+        if (cfuncs_count >= cfuncs_size) {
+          cfuncs_size = (cfuncs_size ? 2*cfuncs_size : 256);
+          cfuncs = (cfunc_t *)realloc(cfuncs, cfuncs_size * sizeof(cfunc_t));
+          if (!cfuncs) {
+            fprintf(stderr, "Out of memory.\n");
+            exit(1);
+          }
+        }
+        cfuncs[cfuncs_count].start = start;
+        cfuncs[cfuncs_count].end = pos;
+        cfuncs_count++;
+      }
+    }
+    else {
+      pos++;
+    }
+  }
+
+  /* The function table is in address order, since we walked ROM in
+     order. aot.c relies on this. */
+  printf("const glui32 aot_story_checksum = 0x%08lxU;\n\n", (long)checksum);
+  printf("const aotstoryfunc_t aot_story_funcs[] = {\n");
+  for (ix=0; ix<cfuncs_count; ix++) {
+    printf("  { 0x%08lxU, 0x%08lxU, aot_%08lx },\n", 
+      (long)cfuncs[ix].start, (long)cfuncs[ix].end, (long)cfuncs[ix].start);
+  }
+  if (cfuncs_count == 0)
+    printf("  { 0, 0, NULL },\n");
+  printf("};\n\n");
+  printf("const glui32 aot_story_count = %d;\n\n", cfuncs_count);
+  printf("#endif /* PRECOMPILED_STORY */\n");
+
+  free(cfuncs);
+}
+
+/* Find the instruction in cinsts which starts at addr, or return -1. */
+static int c_find_inst(glui32 addr)
+{
+  int lo = 0, hi = cinsts_count;
+
+  while (lo < hi) {
+    int mid = (lo + hi) / 2;
+    if (cinsts[mid].addr == addr)
+      return mid;
+    if (cinsts[mid].addr < addr)
+      lo = mid+1;
+    else
+      hi = mid;
+  }
+  return -1;
+}
+
+/* The address that a branch instruction jumps to. (The caller must
+   check that the offset is not 0 or 1, which mean return.) */
+static glui32 c_branch_target(cinst_t *ci)
+{
+  int jx = opcodes_table[ci->index].no - 1;
+  return ci->next + ci->inst.values[jx] - 2;
+}
+
+static int c_inst_translatable(cinst_t *ci)
+{
+  opcode_t *opco = &opcodes_table[ci->index];
+  int jx, mode, numloads;
+
+  switch (ci->inst.opcode) {
+  case op_nop:
+  case op_add: case op_sub: case op_mul: case op_div: case op_mod:
+  case op_neg: case op_bitand: case op_bitor: case op_bitxor: case op_bitnot:
+  case op_shiftl: case op_sshiftr: case op_ushiftr:
+  case op_jump: case op_jz: case op_jnz: case op_jeq: case op_jne:
+  case op_jlt: case op_jge: case op_jgt: case op_jle:
+  case op_jltu: case op_jgeu: case op_jgtu: case op_jleu:
+  case op_copy: case op_copys: case op_copyb: case op_sexs: case op_sexb:
+  case op_aload: case op_aloads: case op_aloadb:
+  case op_astore: case op_astores: case op_astoreb:
+    break;
+  default:
+    return FALSE;
+  }
+
+  numloads = opco->no;
+  if (opco->flags & (St|Br))
+    numloads--;
+
+  for (jx=0; jx<numloads; jx++) {
+    mode = ci->inst.modes[jx];
+    if (mode == 4 || mode == 12)
+      return FALSE;
+  }
+
+  if (opco->flags & St) {
+    mode = ci->inst.modes[numloads];
+    if ((mode >= 1 && mode <= 4) || mode == 12)
+      return FALSE;
+    /* Leave writes to address zero to the interpreter, which may
+       tolerate them (TOLERATE_SUPERGLUS_BUG). */
+    if (mode >= 5 && mode <= 7 && ci->inst.values[numloads] == 0)
+      return FALSE;
+  }
+
+  if (opco->flags & Br) {
+    /* Only a constant offset, which doesn't mean return. */
+    mode = ci->inst.modes[numloads];
+    if (mode > 3)
+      return FALSE;
+    if (ci->inst.values[numloads] == 0 || ci->inst.values[numloads] == 1)
+      return FALSE;
+  }
+
+  return TRUE;
+}
+
+static void c_emit_function(glui32 start, glui32 end)
+{
+  int ix, jx;
+  cinst_t *ci;
+
+  for (ix=0; ix<cinsts_count; ix++) {
+    cinsts[ix].translatable = c_inst_translatable(&cinsts[ix]);
+    cinsts[ix].entry = FALSE;
+  }
+
+  /* The function can be entered at its start, at any branch target, and
+     after any instruction that the interpreter has to execute. */
+  cinsts[0].entry = TRUE;
+  for (ix=0; ix<cinsts_count; ix++) {
+    ci = &cinsts[ix];
+    if (!ci->translatable) {
+      if (ix+1 < cinsts_count)
+        cinsts[ix+1].entry = TRUE;
+    }
+    else if (opcodes_table[ci->index].flags & Br) {
+      jx = c_find_inst(c_branch_target(ci));
+      if (jx >= 0)
+        cinsts[jx].entry = TRUE;
+    }
+  }
+
+  printf("static glui32 aot_%08lx(glui32 entry)\n", (long)start);
+  printf("{\n");
+  printf("  glui32 v0, v1, v2;\n");
+  printf("  glui32 budget = AOT_LOOP_BUDGET;\n\n");
+  printf("  switch (entry) {\n");
+  for (ix=0; ix<cinsts_count; ix++) {
+    if (cinsts[ix].entry)
+      printf("  case 0x%08lxU: goto L_%08lx;\n", 
+        (long)cinsts[ix].addr, (long)cinsts[ix].addr);
+  }
+  printf("  default: return 0;\n");
+  printf("  }\n\n");
+
+  for (ix=0; ix<cinsts_count; ix++) {
+    c_emit_inst(&cinsts[ix]);
+  }
+
+  printf("  return 0x%08lxU;\n", (long)end);
+  printf("}\n\n");
+}
+
+static void c_emit_inst(cinst_t *ci)
+{
+  opcode_t *opco = &opcodes_table[ci->index];
+  char *op = NULL;
+
+  if (ci->entry)
+    printf(" L_%08lx:\n", (long)ci->addr);
+  printf("  /* %08lx: %s */\n", (long)ci->addr, opco->name);
+
+  if (!ci->translatable) {
+    printf("  return 0x%08lxU;\n", (long)ci->addr);
+    return;
+  }
+
+  switch (ci->inst.opcode) {
+  case op_nop:
+    break;
+
+  case op_add: op = "v0 + v1"; goto Binary;
+  case op_sub: op = "v0 - v1"; goto Binary;
+  case op_mul: op = "v0 * v1"; goto Binary;
+  case op_div: op = "perform_divide(v0, v1)"; goto Binary;
+  case op_mod: op = "perform_remainder(v0, v1)"; goto Binary;
+  case op_bitand: op = "v0 & v1"; goto Binary;
+  case op_bitor: op = "v0 | v1"; goto Binary;
+  case op_bitxor: op = "v0 ^ v1"; goto Binary;
+  case op_shiftl: 
+    op = "(v1 >= 32) ? 0 : (v0 << v1)"; 
+    goto Binary;
+  case op_ushiftr: 
+    op = "(v1 >= 32) ? 0 : (v0 >> v1)"; 
+    goto Binary;
+  case op_sshiftr: 
+    op = "(v1 >= 32) ? ((v0 & 0x80000000) ? 0xFFFFFFFF : 0) : (glui32)((glsi32)v0 >> v1)"; 
+    goto Binary;
+  case op_aload: op = "Mem4(v0 + 4 * v1)"; goto Binary;
+  case op_aloads: op = "Mem2(v0 + 2 * v1)"; goto Binary;
+  case op_aloadb: op = "Mem1(v0 + v1)"; goto Binary;
+  Binary:
+    c_emit_load(ci, 0, 4, "v0");
+    c_emit_load(ci, 1, 4, "v1");
+    printf("  v2 = %s;\n", op);
+    c_emit_store(ci, 2, 4, "v2");
+    break;
+
+  case op_neg: op = "-v0"; goto Unary;
+  case op_bitnot: op = "~v0"; goto Unary;
+  case op_sexs: 
+    op = "(v0 & 0x8000) ? (v0 | 0xFFFF0000) : (v0 & 0x0000FFFF)"; 
+    goto Unary;
+  case op_sexb: 
+    op = "(v0 & 0x80) ? (v0 | 0xFFFFFF00) : (v0 & 0x000000FF)"; 
+    goto Unary;
+  Unary:
+    c_emit_load(ci, 0, 4, "v0");
+    printf("  v1 = %s;\n", op);
+    c_emit_store(ci, 1, 4, "v1");
+    break;
+
+  case op_copy:
+    c_emit_load(ci, 0, 4, "v0");
+    c_emit_store(ci, 1, 4, "v0");
+    break;
+  case op_copys:
+    c_emit_load(ci, 0, 2, "v0");
+    c_emit_store(ci, 1, 2, "v0");
+    break;
+  case op_copyb:
+    c_emit_load(ci, 0, 1, "v0");
+    c_emit_store(ci, 1, 1, "v0");
+    break;
+
+  case op_astore: op = "MemW4(v0 + 4 * v1, v2)"; goto ArrayStore;
+  case op_astores: op = "MemW2(v0 + 2 * v1, v2)"; goto ArrayStore;
+  case op_astoreb: op = "MemW1(v0 + v1, v2)"; goto ArrayStore;
+  ArrayStore:
+    c_emit_load(ci, 0, 4, "v0");
+    c_emit_load(ci, 1, 4, "v1");
+    c_emit_load(ci, 2, 4, "v2");
+    printf("  %s;\n", op);
+    break;
+
+  case op_jump:
+    c_emit_branch(ci, NULL);
+    break;
+  case op_jz:
+    c_emit_load(ci, 0, 4, "v0");
+    c_emit_branch(ci, "v0 == 0");
+    break;
+  case op_jnz:
+    c_emit_load(ci, 0, 4, "v0");
+    c_emit_branch(ci, "v0 != 0");
+    break;
+  case op_jeq: op = "v0 == v1"; goto Compare;
+  case op_jne: op = "v0 != v1"; goto Compare;
+  case op_jlt: op = "(glsi32)v0 < (glsi32)v1"; goto Compare;
+  case op_jge: op = "(glsi32)v0 >= (glsi32)v1"; goto Compare;
+  case op_jgt: op = "(glsi32)v0 > (glsi32)v1"; goto Compare;
+  case op_jle: op = "(glsi32)v0 <= (glsi32)v1"; goto Compare;
+  case op_jltu: op = "v0 < v1"; goto Compare;
+  case op_jgeu: op = "v0 >= v1"; goto Compare;
+  case op_jgtu: op = "v0 > v1"; goto Compare;
+  case op_jleu: op = "v0 <= v1"; goto Compare;
+  Compare:
+    c_emit_load(ci, 0, 4, "v0");
+    c_emit_load(ci, 1, 4, "v1");
+    c_emit_branch(ci, op);
+    break;
+  }
+}
+
+/* Emit code to load operand jx into the variable dest. */
+static void c_emit_load(cinst_t *ci, int jx, int argsize, char *dest)
+{
+  int mode = ci->inst.modes[jx];
+  glui32 val = ci->inst.values[jx];
+  int ch = (argsize == 4) ? '4' : ((argsize == 2) ? '2' : '1');
+
+  switch (mode) {
+  case 0:
+    printf("  %s = 0;\n", dest);
+    break;
+  case 1: case 2: case 3:
+    printf("  %s = 0x%08lxU;\n", dest, (long)val);
+    break;
+  case 5: case 6: case 7:
+    printf("  %s = Mem%c(0x%08lxU);\n", dest, ch, (long)val);
+    break;
+  case 13: case 14: case 15:
+    printf("  %s = Mem%c(0x%08lxU);\n", dest, ch, (long)(glui32)(val+ramstart));
+    break;
+  case 8:
+    printf("  AOT_POP(%s);\n", dest);
+    break;
+  case 9: case 10: case 11:
+    printf("  %s = Stk%c(localsbase+0x%08lxU);\n", dest, ch, (long)val);
+    break;
+  }
+}
+
+/* Emit code to store the variable src into operand jx. */
+static void c_emit_store(cinst_t *ci, int jx, int size, char *src)
+{
+  int mode = ci->inst.modes[jx];
+  glui32 val = ci->inst.values[jx];
+  int ch = (size == 4) ? '4' : ((size == 2) ? '2' : '1');
+  char *mask = (size == 4) ? "" : ((size == 2) ? " & 0xFFFF" : " & 0xFF");
+
+  switch (mode) {
+  case 0:
+    break;
+  case 5: case 6: case 7:
+    printf("  MemW%c(0x%08lxU, %s%s);\n", ch, (long)val, src, mask);
+    break;
+  case 13: case 14: case 15:
+    printf("  MemW%c(0x%08lxU, %s%s);\n", ch, (long)(glui32)(val+ramstart), 
+      src, mask);
+    break;
+  case 8:
+    printf("  AOT_PUSH(%s%s);\n", src, mask);
+    break;
+  case 9: case 10: case 11:
+    printf("  StkW%c(localsbase+0x%08lxU, %s%s);\n", ch, (long)val, 
+      src, mask);
+    break;
+  }
+}
+
+/* Emit a branch, taken if cond is true (or always, if cond is NULL).
+   A backward branch uses up the loop budget, so that a long loop
+   returns to the interpreter now and then. */
+static void c_emit_branch(cinst_t *ci, char *cond)
+{
+  glui32 target = c_branch_target(ci);
+  int jx = c_find_inst(target);
+  char *indent = (cond ? "    " : "  ");
+
+  if (cond)
+    printf("  if (%s) {\n", cond);
+  if (jx < 0) {
+    printf("%sreturn 0x%08lxU;\n", indent, (long)target);
+  }
+  else {
+    if (target <= ci->addr)
+      printf("%sif (--budget == 0) return 0x%08lxU;\n", indent, 
+        (long)target);
+    printf("%sgoto L_%08lx;\n", indent, (long)target);
+  }
+  if (cond)
+    printf("  }\n");
+}
+
 void dump_objs()
 {
   glui32 startpos, pos, nextstartpos, proptablepos;
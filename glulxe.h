@@ -44,6 +44,84 @@ typedef int16_t glsi16;
    game files from crashing the interpreter. */
 #define VERIFY_MEMORY_ACCESS (1)
 
+/* Uncomment this definition to check main-memory accesses with guard
+   pages rather than by testing every address. Main memory is placed in
+   a reserved 4GB span of address space, with everything past endmem
+   inaccessible; a stray access faults, and the fault is reported as
+   the usual "Memory access out of range" error. (For an access which
+   straddles endmem, the address reported may be a few bytes off from
+   the checked version.) Writes still check that they are not below
+   ramstart, since ROM and RAM can share a page. This only works on
+   64-bit Unix (OS_UNIX). It replaces the main-memory part of
+   VERIFY_MEMORY_ACCESS; stack accesses are still checked as before. */
+/* #define GUARD_MEMORY_ACCESS (1) */
+
+#if defined(GUARD_MEMORY_ACCESS) && !(defined(OS_UNIX) && defined(__LP64__))
+#undef GUARD_MEMORY_ACCESS
+#endif /* GUARD_MEMORY_ACCESS */
+
+#ifdef GUARD_MEMORY_ACCESS
+#include <setjmp.h>
+#endif /* GUARD_MEMORY_ACCESS */
+
+/* Uncomment this definition to map the game file into memory, rather
+   than reading it in. The mapping is copy-on-write: pages come straight
+   from the OS's file cache until they're modified, so loading is
+   nearly free, and all the glulxe processes playing one game file
+   share a single copy of its ROM. This works for a bare Glulx file or
+   one inside a Blorb file, but it needs the startup code to set
+   gamefile_pathname; otherwise we fall back to reading the file. This
+   only works on Unix (OS_UNIX), and is ignored if GUARD_MEMORY_ACCESS
+   is on.
+   Caution: the game file must not change while the game is running.
+   Unmodified pages are read from the file on demand, so if it is
+   truncated the interpreter dies with SIGBUS, and if it is rewritten
+   in place the game's ROM silently changes under it. (The checksum is
+   only verified at startup.) Replace a game file by renaming a new one
+   into place, never by writing over it. This is why the option is off
+   by default. */
+/* #define MAP_GAME_FILE (1) */
+
+#if defined(MAP_GAME_FILE) && !(defined(OS_UNIX) \
+  && !defined(GUARD_MEMORY_ACCESS))
+#undef MAP_GAME_FILE
+#endif /* MAP_GAME_FILE */
+
+/* Uncomment this definition to reserve address space for main memory
+   and the stack, rather than allocating them. The OS then commits (and
+   zeroes) each page only when it's first touched, so stack and memory
+   that the game never uses cost nothing. Main memory gets enough room
+   to grow in place, so @setmemsize and @malloc don't have to copy it.
+   (On a 32-bit system, growth past 256MB still copies.) This only works
+   on Unix (OS_UNIX), and is ignored if GUARD_MEMORY_ACCESS is on.
+   MAP_GAME_FILE turns it on, since the game file has to be mapped into
+   a block like this. */
+/* #define RESERVE_MEMORY (1) */
+
+#if defined(MAP_GAME_FILE) && !defined(RESERVE_MEMORY)
+#define RESERVE_MEMORY (1)
+#endif /* MAP_GAME_FILE */
+
+#if defined(RESERVE_MEMORY) && !(defined(OS_UNIX) \
+  && !defined(GUARD_MEMORY_ACCESS))
+#undef RESERVE_MEMORY
+#endif /* RESERVE_MEMORY */
+
+/* Uncomment this definition to add a --forkserver option to the Unix
+   startup code. With it, glulxe loads and sets up the game, and then
+   listens on a Unix-domain socket rather than running it. Each
+   connection forks a child process, which plays a fresh game with the
+   connection as its stdin, stdout, and stderr. The child starts with
+   the server's memory (copy-on-write), so it skips loading the game
+   file and building the string-decoding tables. This is only useful
+   with a stdio-based Glk library, such as cheapglk or remglk. This
+   only works on Unix (OS_UNIX). */
+/* #define FORK_SERVER (1) */
+
+#if defined(FORK_SERVER) && !defined(OS_UNIX)
+#undef FORK_SERVER
+#endif /* FORK_SERVER */
+
 /* Uncomment this definition to permit an exception for memory-address
    checking for @glk and @copy opcodes that try to write to memory address 0.
    This was a bug in old Superglus-built game files. */
@@ -78,8 +156,125 @@ typedef int16_t glsi16;
    every time. */
 #define SERIALIZE_CACHE_RAM (1)
 
+/* Comment this definition to turn off the instruction decode cache.
+   With the cache on, each instruction in ROM is decoded once; later
+   executions reuse the stored opcode, operand modes, and immediate
+   values. (Code in RAM is always decoded afresh, since it might have
+   changed.) The cache costs a fixed block of memory; see operand.c. */
+#define DECODE_CACHE (1)
+
+/* Comment this definition to dispatch opcodes with the plain switch
+   statements in exec.c. With it on, each opcode jumps directly to its
+   handler through a table of label addresses. This only takes effect
+   when compiling with GCC or Clang, which support labels as values;
+   other compilers always use the switch. */
+#define DISPATCH_TABLE (1)
+
+/* Uncomment this definition to turn on the basic-block JIT compiler.
+   Frequently-executed stretches of ROM code are translated into native
+   machine code; see jit.c for what it can handle. This only works on
+   x86-64 Unix (OS_UNIX), and it needs DECODE_CACHE. It is ignored
+   when profiling or the debugger is on, since translated code does not
+   count instructions. */
+/* #define JIT_COMPILER (1) */
+
+/* Uncomment this definition to link in a precompiled story: a game
+   file's ROM functions translated to C by "glulxdump -c". When the
+   game being played has the same checksum, the translated code runs
+   in place of the interpreter wherever it can; see aot.c. The
+   generated C file must be added to the build (see the Makefile).
+   This replaces JIT_COMPILER, and it is ignored when profiling or the
+   debugger is on. */
+/* #define PRECOMPILED_STORY (1) */
+
+/* Comment this definition to turn off superinstructions. With them on,
+   certain common pairs of instructions in ROM (such as an @aload to
+   the stack followed by a @jz on that value) are recognized when they
+   are decoded, and executed together. This needs DECODE_CACHE, and is
+   ignored when profiling or the debugger is on. */
+#define FUSED_OPCODES (1)
+
+/* Comment this definition to turn off the call cache. With it on, each
+   call instruction remembers the function it last called, along with
+   that function's acceleration status and decoded locals format, so
+   that calling it again skips both lookups. Decoded function headers
+   are also cached by function address, for other calls. See funcs.c. */
+#define CALL_CACHE (1)
+
+/* Uncomment this definition to count call-cache and function-cache hits
+   and misses, and add a --cachestats option (to the Unix startup code)
+   which displays the counts at exit. This is for checking that the
+   caches are doing their job on a particular game. It is ignored if
+   CALL_CACHE is off. */
+/* #define CACHE_STATS (1) */
+
+/* Comment this definition to read and write big-endian values in main
+   memory one byte at a time. With it on, Read4() and the rest do a
+   single (possibly unaligned) load or store, and swap the bytes with a
+   compiler builtin if the machine is little-endian. An optimizing
+   compiler often finds this on its own, but not at lower optimization
+   levels. This only takes effect when compiling with GCC or Clang;
+   other compilers always use the byte-at-a-time macros. */
+#define NATIVE_MEMORY_ACCESS (1)
+
+#if defined(CACHE_STATS) && !defined(CALL_CACHE)
+#undef CACHE_STATS
+#endif /* CACHE_STATS */
+
+#if defined(FUSED_OPCODES) && !(defined(DECODE_CACHE) \
+  && !VM_PROFILING && !VM_DEBUGGER)
+#undef FUSED_OPCODES
+#endif /* FUSED_OPCODES */
+
+#if defined(PRECOMPILED_STORY) && (VM_PROFILING || VM_DEBUGGER)
+#undef PRECOMPILED_STORY
+#endif /* PRECOMPILED_STORY */
+
+#if defined(JIT_COMPILER) && !(defined(OS_UNIX) && defined(__x86_64__) \
+  && defined(DECODE_CACHE) && !defined(PRECOMPILED_STORY) \
+  && !VM_PROFILING && !VM_DEBUGGER)
+#undef JIT_COMPILER
+#endif /* JIT_COMPILER */
+
+#if defined(NATIVE_MEMORY_ACCESS) && !(defined(__GNUC__) \
+  && defined(__BYTE_ORDER__) \
+  && (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__ \
+    || __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__))
+#undef NATIVE_MEMORY_ACCESS
+#endif /* NATIVE_MEMORY_ACCESS */
+
 /* Some macros to read and write integers to memory, always in big-endian
    format. */
+#ifdef NATIVE_MEMORY_ACCESS
+
+/* These types tell the compiler that the pointer may be unaligned, and
+   may alias anything, so the access is done as a single load or store
+   wherever the CPU allows it. */
+typedef glui32 glui32_unaligned __attribute__((__aligned__(1), __may_alias__));
+typedef glui16 glui16_unaligned __attribute__((__aligned__(1), __may_alias__));
+
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define Read4(ptr)    \
+  ((glui32)__builtin_bswap32(*(glui32_unaligned *)(ptr)))
+#define Read2(ptr)    \
+  ((glui16)__builtin_bswap16(*(glui16_unaligned *)(ptr)))
+#define Write4(ptr, vl)   \
+  (*(glui32_unaligned *)(ptr) = __builtin_bswap32((glui32)(vl)))
+#define Write2(ptr, vl)   \
+  (*(glui16_unaligned *)(ptr) = __builtin_bswap16((glui16)(vl)))
+#else /* __ORDER_BIG_ENDIAN__ */
+#define Read4(ptr)    \
+  ((glui32)*(glui32_unaligned *)(ptr))
+#define Read2(ptr)    \
+  ((glui16)*(glui16_unaligned *)(ptr))
+#define Write4(ptr, vl)   \
+  (*(glui32_unaligned *)(ptr) = (glui32)(vl))
+#define Write2(ptr, vl)   \
+  (*(glui16_unaligned *)(ptr) = (glui16)(vl))
+#endif /* __BYTE_ORDER__ */
+
+#else /* NATIVE_MEMORY_ACCESS */
+
 #define Read4(ptr)    \
   ( (glui32)((glui32)((unsigned char *)(ptr))[0] << 24)  \
   | (glui32)((glui32)((unsigned char *)(ptr))[1] << 16)  \
@@ -88,9 +283,6 @@ typedef int16_t glsi16;
 #define Read2(ptr)    \
   ( (glui16)(((unsigned char *)(ptr))[0] << 8)  \
   | (glui16)(((unsigned char *)(ptr))[1]))
-#define Read1(ptr)    \
-  ((unsigned char)(((unsigned char *)(ptr))[0]))
-
 #define Write4(ptr, vl)   \
   (((ptr)[0] = (unsigned char)(((glui32)(vl)) >> 24)),   \
    ((ptr)[1] = (unsigned char)(((glui32)(vl)) >> 16)),   \
@@ -99,25 +291,48 @@ typedef int16_t glsi16;
 #define Write2(ptr, vl)   \
   (((ptr)[0] = (unsigned char)(((glui32)(vl)) >> 8)),   \
    ((ptr)[1] = (unsigned char)(((glui32)(vl)))))
+
+#endif /* NATIVE_MEMORY_ACCESS */
+
+#define Read1(ptr)    \
+  ((unsigned char)(((unsigned char *)(ptr))[0]))
 #define Write1(ptr, vl)   \
   (((unsigned char *)(ptr))[0] = (vl))
 
-#if VERIFY_MEMORY_ACCESS
+#ifdef GUARD_MEMORY_ACCESS
+#define Verify(adr, ln) (0)
+#define VerifyW(adr, ln)  \
+  ((adr) < ramstart ? verify_address_write(adr, ln) : (void)0)
+#elif VERIFY_MEMORY_ACCESS
 #define Verify(adr, ln) verify_address(adr, ln)
 #define VerifyW(adr, ln) verify_address_write(adr, ln)
-#define VerifyStk(adr, ln) verify_address_stack(adr, ln)
 #else
 #define Verify(adr, ln) (0)
 #define VerifyW(adr, ln) (0)
+#endif /* GUARD_MEMORY_ACCESS */
+
+#if VERIFY_MEMORY_ACCESS
+#define VerifyStk(adr, ln) verify_address_stack(adr, ln)
+#else
 #define VerifyStk(adr, ln) (0)
 #endif /* VERIFY_MEMORY_ACCESS */
 
 #define Mem1(adr)  (Verify(adr, 1), Read1(memmap+(adr)))
 #define Mem2(adr)  (Verify(adr, 2), Read2(memmap+(adr)))
 #define Mem4(adr)  (Verify(adr, 4), Read4(memmap+(adr)))
-#define MemW1(adr, vl)  (VerifyW(adr, 1), Write1(memmap+(adr), (vl)))
-#define MemW2(adr, vl)  (VerifyW(adr, 2), Write2(memmap+(adr), (vl)))
-#define MemW4(adr, vl)  (VerifyW(adr, 4), Write4(memmap+(adr), (vl)))
+#define MemW1(adr, vl)  (VerifyW(adr, 1), WatchW(adr), Write1(memmap+(adr), (vl)))
+#define MemW2(adr, vl)  (VerifyW(adr, 2), WatchW(adr), Write2(memmap+(adr), (vl)))
+#define MemW4(adr, vl)  (VerifyW(adr, 4), WatchW(adr), Write4(memmap+(adr), (vl)))
+
+/* WatchW() notices a write to the watched range of memory: the part of
+   RAM that the string-decoding cache was built from. The range is
+   widened by three bytes at the start, so that checking the address of
+   a multibyte write is enough. watchlen is zero when nothing is
+   watched. Every store into main memory must go through this (or call
+   stream_table_changed() itself). */
+#define WatchW(adr)  \
+  ((glui32)((adr) - watchstart) < watchlen  \
+    ? stream_table_changed() : (void)0)
 
 /* Macros to access values on the stack. These *must* be used 
    with proper alignment! (That is, Stk4 and StkW4 must take 
@@ -160,15 +375,87 @@ typedef struct operandlist_struct {
   int num_ops; /* Number of operands for this opcode */
   int arg_size; /* Usually 4, but can be 1 or 2 */
   int *formlist; /* Array of values, either modeform_Load or modeform_Store */
+  void (*parser)(oparg_t *args); /* Specialized parse_operands(), or NULL */
 } operandlist_t;
 #define modeform_Load (1)
 #define modeform_Store (2)
 
+/* decodedinst_t:
+   Represents one instruction in the decode cache. The kinds array
+   describes each operand (a constant, main memory, locals, or the
+   stack), and values holds the matching constant or address. The addr
+   field is 0xFFFFFFFF for an unused entry.
+*/
+typedef struct decodedinst_struct {
+  glui32 addr; /* Address of the instruction's opcode */
+  glui32 nextaddr; /* Address of the following instruction */
+  glui32 opcode;
+  const operandlist_t *oplist;
+  unsigned char kinds[MAX_OPERANDS];
+  glui32 values[MAX_OPERANDS];
+#ifdef FUSED_OPCODES
+  int fusion; /* fuse_None, or the kind of pair */
+  glui32 fusedop; /* The second instruction's opcode... */
+  glui32 fusednext; /* ...the address after it... */
+  unsigned char fusedkinds[3]; /* ...and its operands */
+  glui32 fusedvalues[3];
+#endif /* FUSED_OPCODES */
+} decodedinst_t;
+
+/* The operand kinds in a decodedinst_t. A load kind says where the
+   value comes from; a store kind is the desttype (0 to 4) plus
+   dkind_Store. dkind_LoadMemVerified and desttype 4 are main-memory
+   operands whose fixed address was checked when the instruction was
+   decoded, so they are accessed without checking again. (Desttype 4
+   never appears in a call stub; push_callstub() turns it back into
+   1.) */
+#define dkind_LoadConst (0)
+#define dkind_LoadMem (1)
+#define dkind_LoadLocal (2)
+#define dkind_LoadStack (3)
+#define dkind_LoadMemVerified (4)
+#define dkind_Store (5)
+
+/* The superinstruction pairs; see fuse_instruction() in operand.c. */
+#define fuse_None (0)
+#define fuse_LoadBranch (1)
+#define fuse_CopyAdd (2)
+
+/* The number of entries in the decode cache. This must be a power
+   of two. */
+#define DECODE_CACHE_SIZE (4096)
+
 /* Some useful globals */
 
+/* These hold the state of the one VM that this process runs; the
+   interpreter is not reentrant. The rest of the VM's state is kept in
+   globals and statics scattered through the modules. As of this
+   writing, that means:
+   - vm.c: whether ROM is loaded (romloaded), and the string table's
+     watch range (watchstart, watchlen)
+   - heap.c: the heap
+   - serial.c: the undo chain and the RAM cache
+   - string.c: the I/O system, the output buffer, the string-decoding
+     table cache and its arena, and the decoded-string cache
+   - accel.c: the accelerated functions and their parameters
+   - glkop.c: the Glk object registry and the arrays lent to Glk
+   - operand.c: the decode cache
+   - funcs.c: the call-site and function-header caches
+   - jit.c and aot.c: the JIT arena and block table, and the
+     precompiled-code cache
+   - osdepend.c: the RNG state, the guard-page and memory
+     reservations, and the game-file mapping
+   - unixautosave.c, unixstrt.c: autosave and startup settings
+   Check for new ones before relying on this list. The Glk object
+   registry mirrors the Glk library's own object lists, and the library
+   is a process-wide singleton. So running several games in one process
+   would need a reentrant Glk library as well as moving all of the
+   above into a context structure. */
+
 extern int vm_exited_cleanly;
 extern strid_t gamefile;
 extern glui32 gamefile_start, gamefile_len;
+extern char *gamefile_pathname;
 extern char *init_err, *init_err2;
 
 extern unsigned char *memmap;
@@ -189,6 +476,7 @@ extern glui32 valstackbase;
 extern glui32 localsbase;
 extern glui32 endmem;
 extern glui32 protectstart, protectend;
+extern glui32 watchstart, watchlen;
 extern glui32 prevpc;
 
 extern void (*stream_char_handler)(unsigned char ch);
@@ -196,8 +484,13 @@ extern void (*stream_unichar_handler)(glui32 ch);
 
 /* main.c */
 extern glui32 init_rng_seed;
+#ifdef CACHE_STATS
+extern int pref_cache_stats;
+#endif /* CACHE_STATS */
+extern glui32 tick_interval;
 extern void set_library_start_hook(void (*)(void));
 extern void set_library_autorestore_hook(void (*)(void));
+extern void set_library_fork_hook(void (*)(void));
 extern void fatal_error_handler(char *str, char *arg, int useval, glsi32 val) GLK_ATTRIBUTE_NORETURN;
 extern void nonfatal_warning_handler(char *str, char *arg, int useval, glsi32 val);
 #define fatal_error(s)  (fatal_error_handler((s), NULL, FALSE, 0))
@@ -224,6 +517,8 @@ extern void verify_array_addresses(glui32 addr, glui32 count, glui32 size);
 
 /* exec.c */
 extern void execute_loop(void);
+extern glui32 perform_divide(glui32 dividend, glui32 divisor);
+extern glui32 perform_remainder(glui32 dividend, glui32 divisor);
 
 /* operand.c */
 extern const operandlist_t *fast_operandlist[0x80];
@@ -233,9 +528,30 @@ extern void parse_operands(oparg_t *opargs, const operandlist_t *oplist);
 extern void store_operand(glui32 desttype, glui32 destaddr, glui32 storeval);
 extern void store_operand_s(glui32 desttype, glui32 destaddr, glui32 storeval);
 extern void store_operand_b(glui32 desttype, glui32 destaddr, glui32 storeval);
+#ifdef DECODE_CACHE
+extern decodedinst_t *decodecache;
+extern void init_decode_cache(void);
+extern void final_decode_cache(void);
+extern int decode_instruction(decodedinst_t *dec, glui32 addr);
+extern void parse_decoded_operands(oparg_t *opargs, const decodedinst_t *dec);
+#endif /* DECODE_CACHE */
 
 /* funcs.c */
 extern void enter_function(glui32 addr, glui32 argc, glui32 *argv);
+#ifdef CALL_CACHE
+#ifdef CACHE_STATS
+extern glui32 call_cache_hits, call_cache_misses;
+extern glui32 func_cache_hits, func_cache_misses;
+#endif /* CACHE_STATS */
+extern void init_call_cache(void);
+extern void final_call_cache(void);
+extern void flush_call_cache(void);
+extern void enter_function_from(glui32 callpc, glui32 addr, glui32 argc,
+  glui32 *argv);
+#else /* CALL_CACHE */
+#define enter_function_from(callpc, addr, argc, argv)  \
+  enter_function(addr, argc, argv)
+#endif /* CALL_CACHE */
 extern void leave_function(void);
 extern void push_callstub(glui32 desttype, glui32 destaddr);
 extern void pop_callstub(glui32 returnvalue);
@@ -248,6 +564,8 @@ extern glui32 stream_get_table(void);
 extern void stream_set_table(glui32 addr);
 extern void stream_get_iosys(glui32 *mode, glui32 *rock);
 extern void stream_set_iosys(glui32 mode, glui32 rock);
+extern void stream_flush(void);
+extern void stream_table_changed(void);
 extern char *make_temp_string(glui32 addr);
 extern glui32 *make_temp_ustring(glui32 addr);
 extern void free_temp_string(char *str);
@@ -267,6 +585,7 @@ extern void heap_sanity_check(void);
 extern int max_undo_level;
 extern int init_serial(void);
 extern void final_serial(void);
+extern int reset_ram_from_cache(void);
 extern glui32 perform_save(strid_t str);
 extern glui32 perform_restore(strid_t str, int fromshell);
 extern glui32 perform_saveundo(void);
@@ -292,6 +611,26 @@ extern glui32 linked_search(glui32 key, glui32 keysize,
 extern void *glulx_malloc(glui32 len);
 extern void *glulx_realloc(void *ptr, glui32 len);
 extern void glulx_free(void *ptr);
+#ifdef GUARD_MEMORY_ACCESS
+extern unsigned char *glulx_guarded_malloc(glui32 len);
+extern unsigned char *glulx_guarded_realloc(unsigned char *ptr, 
+  glui32 oldlen, glui32 len);
+extern void glulx_guarded_free(unsigned char *ptr);
+extern sigjmp_buf guard_fault_jmp;
+extern int guard_fault_armed;
+extern glui32 guard_fault_addr;
+#endif /* GUARD_MEMORY_ACCESS */
+#ifdef RESERVE_MEMORY
+extern unsigned char *glulx_reserved_malloc(glui32 len);
+extern unsigned char *glulx_reserved_realloc(unsigned char *ptr, 
+  glui32 oldlen, glui32 len);
+extern void glulx_reserved_free(unsigned char *ptr);
+extern unsigned char *glulx_lazy_malloc(glui32 len);
+extern void glulx_lazy_free(unsigned char *ptr, glui32 len);
+#endif /* RESERVE_MEMORY */
+#ifdef MAP_GAME_FILE
+extern glui32 glulx_map_game(unsigned char *ptr, glui32 limit);
+#endif /* MAP_GAME_FILE */
 extern void glulx_setrandom(glui32 seed);
 extern glui32 glulx_random(void);
 extern void glulx_random_get_detstate(int *usenative, glui32 **arr, int *count);
@@ -318,14 +657,14 @@ extern int init_profile(void);
 extern void profile_set_call_counts(int flag);
 #if VM_PROFILING
 extern glui32 profile_opcount;
-#define profile_tick() (profile_opcount++)
+#define profile_ticks(n) (profile_opcount += (n))
 extern int profile_profiling_active(void);
 extern void profile_in(glui32 addr, glui32 stackuse, int accel);
 extern void profile_out(glui32 stackuse);
 extern void profile_fail(char *reason);
 extern void profile_quit(void);
 #else /* VM_PROFILING */
-#define profile_tick()         (0)
+#define profile_ticks(n)       (0)
 #define profile_profiling_active()         (0)
 #define profile_in(addr, stackuse, accel)  (0)
 #define profile_out(stackuse)  (0)
@@ -335,7 +674,7 @@ extern void profile_quit(void);
 
 #if VM_DEBUGGER
 extern unsigned long debugger_opcount;
-#define debugger_tick() (debugger_opcount++)
+#define debugger_ticks(n) (debugger_opcount += (n))
 extern int debugger_load_info_stream(strid_t stream);
 extern int debugger_load_info_chunk(strid_t stream, glui32 pos, glui32 len);
 extern void debugger_track_cpu(int flag);
@@ -352,7 +691,7 @@ extern void debugger_block_and_debug(char *msg);
 extern void debugger_handle_crash(char *msg);
 extern void debugger_handle_quit(void);
 #else /* VM_DEBUGGER */
-#define debugger_tick()              (0)
+#define debugger_ticks(n)            (0)
 #define debugger_check_story_file()  (0)
 #define debugger_setup_start_state() (0)
 #define debugger_check_func_breakpoint(addr)  (0)
@@ -370,6 +709,32 @@ extern glui32 accel_get_param_count(void);
 extern glui32 accel_get_param(glui32 index);
 extern void accel_iterate_funcs(void (*func)(glui32 index, glui32 addr));
 
+/* jit.c */
+#ifdef JIT_COMPILER
+extern int jit_trigger;
+extern void init_jit(void);
+extern void final_jit(void);
+extern glui32 jit_execute(glui32 addr);
+#endif /* JIT_COMPILER */
+
+/* aot.c */
+#ifdef PRECOMPILED_STORY
+typedef glui32 (*aotfunc_t)(glui32 entry);
+typedef struct aotstoryfunc_struct {
+  glui32 start; /* Address of the function's first instruction */
+  glui32 end; /* Address after its last instruction */
+  aotfunc_t func;
+} aotstoryfunc_t;
+/* These are defined in the generated story file. */
+extern const glui32 aot_story_checksum;
+extern const aotstoryfunc_t aot_story_funcs[];
+extern const glui32 aot_story_count;
+extern int aot_trigger;
+extern void init_aot(void);
+extern void final_aot(void);
+extern glui32 aot_execute(glui32 addr);
+#endif /* PRECOMPILED_STORY */
+
 #ifdef FLOAT_SUPPORT
 
 /* You may have to edit the definition of gfloat32 to make sure it's really
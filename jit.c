@@ -0,0 +1,1008 @@
+/* jit.c: Glulxe code for the basic-block JIT compiler.
+    Designed by Andrew Plotkin <erkyrath@eblong.com>
+    http://eblong.com/zarf/glulx/index.html
+*/
+
+#include "glk.h"
+#include "glulxe.h"
+#include "opcodes.h"
+
+#ifdef JIT_COMPILER
+
+#include <stddef.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+/* The JIT compiler translates frequently-executed stretches of ROM code
+   into x86-64 machine code. A block starts at a function entry point or
+   the target of a backward branch; the interpreter counts how often it
+   reaches each of these, and translates the ones that get hot.
+
+   A block covers the core of the instruction set: arithmetic and bitwise
+   operations, copy, sign extension, array loads and stores, and the
+   branch opcodes. Operands may be constants, locals, fixed main-memory
+   addresses, or the stack. The block ends at the first instruction it
+   can't handle (@call, @glk, @streamstr, and anything else complex);
+   the interpreter takes over from there.
+
+   Any check that would cause a fatal error in the interpreter (stack
+   underflow, an array access out of range) instead makes the block
+   return the address of the offending instruction, with the VM state as
+   it was before that instruction began. The interpreter then executes
+   it, and reports the error in the usual way.
+
+   Translated code is called as a C function, with a pointer to a
+   jitregs_t, and returns the address of the next instruction to
+   execute. Inside a block, the registers are used as follows:
+     rdi: the jitregs_t
+     rsi: memmap
+     r8:  stack
+     r9:  stackptr (32 bits)
+     r10: stack+localsbase
+     rbx: stackptr at the start of the current instruction
+     r11: scratch
+     rax, rcx, rdx: operand values
+*/
+
+typedef struct jitregs_struct {
+  unsigned char *memmap;
+  unsigned char *stack;
+  unsigned char *locals;
+  glui32 stackptr;
+  glui32 valstackbase;
+  glui32 stacksize;
+  glui32 endmem;
+  glui32 ramstart;
+  glui32 watchstart;
+  glui32 watchlen;
+  glui32 budget;
+} jitregs_t;
+
+typedef glui32 (*jitfunc_t)(jitregs_t *regs);
+
+/* A jitblock_t records one potential block start. Until the block is
+   translated, count is the number of times it's been reached. */
+typedef struct jitblock_struct {
+  glui32 addr;
+  glui32 count;
+  glui32 localsneeded; /* Size of the locals segment that the code uses */
+  int failed; /* The first instruction couldn't be translated */
+  jitfunc_t func;
+} jitblock_t;
+
+/* A jitfixup_t is a forward jump in the code being generated, which
+   has to be patched when the block is finished. */
+typedef struct jitfixup_struct {
+  unsigned char *pos; /* The 32-bit jump offset to patch */
+  int kind;
+  glui32 addr; /* The Glulx address to continue at */
+} jitfixup_t;
+
+#define fixup_Branch (1) /* Jump within the block if possible, else exit */
+#define fixup_Exit (2) /* Exit the block */
+#define fixup_Bail (3) /* Restore stackptr and exit the block */
+
+/* The number of entries in the block table. This must be a power of
+   two. */
+#define JIT_TABLE_SIZE (2048)
+/* The number of times a block start must be reached before we translate
+   it. */
+#define JIT_THRESHOLD (32)
+/* The size of the code arena. When it fills up, we throw everything away
+   and start over. */
+#define JIT_ARENA_SIZE (0x100000)
+/* The most instructions (and jump fixups) in one block. */
+#define JIT_MAX_INSTS (256)
+#define JIT_MAX_FIXUPS (512)
+/* The worst-case size of the code for one instruction, and for one
+   fixup stub. */
+#define JIT_INST_ROOM (256)
+#define JIT_STUB_ROOM (24)
+/* The number of backward jumps a block may take before it returns to
+   the interpreter. This keeps glk_tick() and friends running. */
+#define JIT_LOOP_BUDGET (0x4000)
+/* The most blocks we run in a row without returning to the
+   interpreter. */
+#define JIT_CHAIN_LIMIT (64)
+
+/* x86-64 register numbers. */
+#define R_AX (0)
+#define R_CX (1)
+#define R_DX (2)
+#define R_BX (3)
+#define R_SP (4)
+#define R_SI (6)
+#define R_DI (7)
+#define R_8 (8)
+#define R_9 (9)
+#define R_10 (10)
+#define R_11 (11)
+
+/* x86 condition codes, as used by jcc. Flipping the low bit gives the
+   opposite condition. */
+#define cc_B (0x2)
+#define cc_AE (0x3)
+#define cc_E (0x4)
+#define cc_NE (0x5)
+#define cc_BE (0x6)
+#define cc_A (0x7)
+#define cc_L (0xC)
+#define cc_GE (0xD)
+#define cc_LE (0xE)
+#define cc_G (0xF)
+
+/* Set whenever the interpreter reaches a possible block start: a
+   function entry or a backward branch. */
+int jit_trigger = FALSE;
+
+static jitregs_t regs;
+static jitblock_t *blocktable = NULL;
+static unsigned char *arena = NULL;
+static unsigned char *arenaend = NULL;
+static unsigned char *emitptr = NULL;
+
+/* The state of the block being compiled. */
+static int numinsts;
+static glui32 instaddrs[JIT_MAX_INSTS];
+static unsigned char *instcode[JIT_MAX_INSTS];
+static int numfixups;
+static jitfixup_t fixups[JIT_MAX_FIXUPS];
+static glui32 localsneeded;
+
+static jitfunc_t compile_block(glui32 startaddr);
+static void flush_jit(void);
+static int protect_arena(unsigned char *from, int writable);
+
+/* init_jit():
+   Set up the block table and the code arena. If either can't be
+   allocated, we just run without the JIT.
+
+   The arena is never writable and executable at once. It is mapped
+   read-write, and flipped to read-execute; compile_block() makes the
+   unused part writable while it emits a block. (Hardened systems
+   refuse W+X mappings, and may refuse executable ones entirely. In
+   that case we run without the JIT too.)
+*/
+void init_jit()
+{
+  void *ptr;
+  int ix;
+
+  if (!blocktable) {
+    blocktable = (jitblock_t *)glulx_malloc(JIT_TABLE_SIZE
+      * sizeof(jitblock_t));
+    if (!blocktable)
+      return;
+  }
+
+  if (!arena) {
+    ptr = mmap(NULL, JIT_ARENA_SIZE, PROT_READ|PROT_WRITE,
+      MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    if (ptr == MAP_FAILED) {
+      glulx_free(blocktable);
+      blocktable = NULL;
+      return;
+    }
+    arena = (unsigned char *)ptr;
+    arenaend = arena + JIT_ARENA_SIZE;
+    if (!protect_arena(arena, FALSE)) {
+      final_jit();
+      return;
+    }
+  }
+
+  for (ix=0; ix<JIT_TABLE_SIZE; ix++)
+    blocktable[ix].addr = 0xFFFFFFFF;
+  flush_jit();
+}
+
+/* final_jit():
+   Throw away the JIT state when the VM shuts down.
+*/
+void final_jit()
+{
+  if (arena) {
+    munmap(arena, JIT_ARENA_SIZE);
+    arena = NULL;
+    arenaend = NULL;
+    emitptr = NULL;
+  }
+  if (blocktable) {
+    glulx_free(blocktable);
+    blocktable = NULL;
+  }
+}
+
+/* flush_jit():
+   Discard all the translated code, and empty the arena.
+*/
+static void flush_jit()
+{
+  int ix;
+
+  for (ix=0; ix<JIT_TABLE_SIZE; ix++) {
+    blocktable[ix].func = NULL;
+    blocktable[ix].failed = FALSE;
+  }
+  emitptr = arena;
+}
+
+/* protect_arena():
+   Set the protection of the arena, from the page containing from to
+   the end: read-write if writable is set, read-execute otherwise.
+   Returns FALSE if the system refuses.
+*/
+static int protect_arena(unsigned char *from, int writable)
+{
+  static size_t pagesize = 0;
+  unsigned char *start;
+  long val;
+
+  if (!pagesize) {
+    val = sysconf(_SC_PAGESIZE);
+    pagesize = (val > 0) ? (size_t)val : 4096;
+  }
+
+  start = arena + (((size_t)(from - arena)) & ~(pagesize-1));
+  if (start >= arenaend)
+    return TRUE;
+  if (mprotect(start, arenaend - start,
+    writable ? (PROT_READ|PROT_WRITE) : (PROT_READ|PROT_EXEC)) != 0)
+    return FALSE;
+  return TRUE;
+}
+
+/* jit_execute():
+   Called by the interpreter when it reaches a possible block start.
+   This runs the translated code for addr (translating it first, if it
+   has become hot), and then any further blocks that follow. Returns
+   the address at which the interpreter should continue; this is addr
+   itself if nothing was run.
+*/
+glui32 jit_execute(glui32 addr)
+{
+  int chain;
+  jitblock_t *blk;
+  jitfunc_t func;
+  glui32 newaddr;
+
+  if (!blocktable)
+    return addr;
+
+  for (chain=0; chain<JIT_CHAIN_LIMIT; chain++) {
+    if (addr >= ramstart)
+      break;
+
+    blk = &(blocktable[(addr ^ (addr >> 11)) & (JIT_TABLE_SIZE-1)]);
+    if (blk->addr != addr) {
+      blk->addr = addr;
+      blk->count = 0;
+      blk->failed = FALSE;
+      blk->func = NULL;
+    }
+
+    if (!blk->func) {
+      if (blk->failed)
+        break;
+      blk->count++;
+      if (blk->count < JIT_THRESHOLD)
+        break;
+      func = compile_block(addr);
+      if (!func && emitptr == arena && blocktable) {
+        /* Out of room, and flushed. Try again. */
+        func = compile_block(addr);
+      }
+      if (!blocktable) {
+        /* The arena could not be reprotected, so the JIT has shut
+           down (and blk is gone). */
+        return addr;
+      }
+      blk->func = func;
+      if (!blk->func) {
+        blk->failed = TRUE;
+        break;
+      }
+      blk->localsneeded = localsneeded;
+    }
+
+    /* The block was translated in some particular function's frame.
+       Make sure the current frame is big enough for it. */
+    if (valstackbase - localsbase < blk->localsneeded)
+      break;
+
+    regs.memmap = memmap;
+    regs.stack = stack;
+    regs.locals = stack + localsbase;
+    regs.stackptr = stackptr;
+    regs.valstackbase = valstackbase;
+    regs.stacksize = stacksize;
+    regs.endmem = endmem;
+    regs.ramstart = ramstart;
+    regs.watchstart = watchstart;
+    regs.watchlen = watchlen;
+    regs.budget = JIT_LOOP_BUDGET;
+    newaddr = blk->func(&regs);
+    stackptr = regs.stackptr;
+
+    /* If the block stopped without getting anywhere, let the
+       interpreter handle this instruction. */
+    if (newaddr == addr)
+      break;
+    addr = newaddr;
+  }
+
+  return addr;
+}
+
+/* Simple machine-code emitters. In the ones that take two registers,
+   the "reg" argument goes in the ModRM reg field; "rm" or "base" is
+   the other operand. Opcodes larger than 0xFF are two-byte opcodes
+   beginning with 0x0F. */
+
+static void emit1(int val)
+{
+  *emitptr = (unsigned char)val;
+  emitptr++;
+}
+
+static void emit4(glui32 val)
+{
+  emit1(val & 0xFF);
+  emit1((val >> 8) & 0xFF);
+  emit1((val >> 16) & 0xFF);
+  emit1((val >> 24) & 0xFF);
+}
+
+static void emit_rex(int wide, int reg, int index, int base)
+{
+  int rex = 0x40;
+  if (wide)
+    rex |= 0x08;
+  if (reg & 8)
+    rex |= 0x04;
+  if (index & 8)
+    rex |= 0x02;
+  if (base & 8)
+    rex |= 0x01;
+  if (rex != 0x40)
+    emit1(rex);
+}
+
+static void emit_opcode(int op)
+{
+  if (op > 0xFF)
+    emit1(op >> 8);
+  emit1(op & 0xFF);
+}
+
+/* op reg, rm (register to register) */
+static void emit_rr(int wide, int op, int reg, int rm)
+{
+  emit_rex(wide, reg, 0, rm);
+  emit_opcode(op);
+  emit1(0xC0 | ((reg & 7) << 3) | (rm & 7));
+}
+
+/* op reg, [base+disp32] */
+static void emit_rm(int wide, int op, int reg, int base, glui32 disp)
+{
+  emit_rex(wide, reg, 0, base);
+  emit_opcode(op);
+  emit1(0x80 | ((reg & 7) << 3) | (base & 7));
+  if ((base & 7) == R_SP)
+    emit1(0x24);
+  emit4(disp);
+}
+
+/* op reg, [base+index<<scale] (base must not be rbp or r13) */
+static void emit_rx(int op, int reg, int base, int index, int scale)
+{
+  emit_rex(FALSE, reg, index, base);
+  emit_opcode(op);
+  emit1(0x04 | ((reg & 7) << 3));
+  emit1((scale << 6) | ((index & 7) << 3) | (base & 7));
+}
+
+/* op reg, imm32, for the 0x81 group (add, or, and, sub, cmp...) */
+static void emit_ri(int ext, int reg, glui32 val)
+{
+  emit_rex(FALSE, 0, 0, reg);
+  emit1(0x81);
+  emit1(0xC0 | (ext << 3) | (reg & 7));
+  emit4(val);
+}
+
+static void emit_mov_imm(int reg, glui32 val)
+{
+  emit_rex(FALSE, 0, 0, reg);
+  emit1(0xB8 | (reg & 7));
+  emit4(val);
+}
+
+static void emit_bswap(int reg)
+{
+  emit_rex(FALSE, 0, 0, reg);
+  emit1(0x0F);
+  emit1(0xC8 | (reg & 7));
+}
+
+/* Emit a jump (or a conditional jump, if cc is not -1) with a blank
+   32-bit offset. Returns the location of the offset. */
+static unsigned char *emit_jump(int cc)
+{
+  unsigned char *pos;
+  if (cc < 0) {
+    emit1(0xE9);
+  }
+  else {
+    emit1(0x0F);
+    emit1(0x80 | cc);
+  }
+  pos = emitptr;
+  emit4(0);
+  return pos;
+}
+
+static void patch_jump(unsigned char *pos, unsigned char *dest)
+{
+  glui32 offset = (glui32)(dest - (pos+4));
+  pos[0] = offset & 0xFF;
+  pos[1] = (offset >> 8) & 0xFF;
+  pos[2] = (offset >> 16) & 0xFF;
+  pos[3] = (offset >> 24) & 0xFF;
+}
+
+static void add_fixup(unsigned char *pos, int kind, glui32 addr)
+{
+  fixups[numfixups].pos = pos;
+  fixups[numfixups].kind = kind;
+  fixups[numfixups].addr = addr;
+  numfixups++;
+}
+
+/* Store back stackptr and return the address in eax. */
+static void emit_exit()
+{
+  emit_rm(FALSE, 0x89, R_9, R_DI, offsetof(jitregs_t, stackptr));
+  emit1(0x58 | R_BX); /* pop rbx */
+  emit1(0xC3); /* ret */
+}
+
+/* Leave the block if the address in r11 is watched (see WatchW() in
+   glulxe.h), so that the interpreter does the store. Clobbers r11. */
+static void emit_check_watch(glui32 instaddr)
+{
+  emit_rm(FALSE, 0x2B, R_11, R_DI, offsetof(jitregs_t, watchstart));
+  emit_rm(FALSE, 0x3B, R_11, R_DI, offsetof(jitregs_t, watchlen));
+  add_fixup(emit_jump(cc_B), fixup_Bail, instaddr);
+}
+
+/* Check that count bytes starting at the address in eax are readable
+   (or writable) main memory. With GUARD_MEMORY_ACCESS, only the ramstart
+   test is needed; an access past endmem faults on its own. A write must
+   also stay out of the watched range. */
+static void emit_check_memory(glui32 instaddr, int count, int write)
+{
+  if (write) {
+    emit_rm(FALSE, 0x3B, R_AX, R_DI, offsetof(jitregs_t, ramstart));
+    add_fixup(emit_jump(cc_B), fixup_Bail, instaddr);
+  }
+#ifndef GUARD_MEMORY_ACCESS
+  emit_rm(FALSE, 0x8D, R_11, R_AX, count-1); /* lea r11d, [rax+count-1] */
+  emit_rm(FALSE, 0x3B, R_AX, R_DI, offsetof(jitregs_t, endmem));
+  add_fixup(emit_jump(cc_AE), fixup_Bail, instaddr);
+  emit_rm(FALSE, 0x3B, R_11, R_DI, offsetof(jitregs_t, endmem));
+  add_fixup(emit_jump(cc_AE), fixup_Bail, instaddr);
+#endif /* GUARD_MEMORY_ACCESS */
+  if (write) {
+    emit_rr(FALSE, 0x89, R_AX, R_11); /* mov r11d, eax */
+    emit_check_watch(instaddr);
+  }
+}
+
+/* Whether a fixed main-memory operand can be accessed without a check.
+   The memory map can shrink, but never below origendmem. */
+static int fixed_address_ok(glui32 addr, int write)
+{
+  if (addr >= origendmem || origendmem - addr < 4)
+    return FALSE;
+  if (addr > 0x7FFFFFF0)
+    return FALSE;
+  if (write && addr < ramstart)
+    return FALSE;
+  return TRUE;
+}
+
+static int local_offset_ok(glui32 offset)
+{
+  return ((offset & 3) == 0 && offset < 0x10000);
+}
+
+static void note_local(glui32 offset)
+{
+  if (localsneeded < offset+4)
+    localsneeded = offset+4;
+}
+
+/* Load operand ix of the instruction into the given register. */
+static void emit_load(decodedinst_t *dec, int ix, int reg)
+{
+  glui32 value = dec->values[ix];
+
+  switch (dec->kinds[ix]) {
+  case dkind_LoadConst:
+    emit_mov_imm(reg, value);
+    break;
+  case dkind_LoadMem:
+  case dkind_LoadMemVerified:
+    emit_rm(FALSE, 0x8B, reg, R_SI, value);
+    emit_bswap(reg);
+    break;
+  case dkind_LoadLocal:
+    emit_rm(FALSE, 0x8B, reg, R_10, value);
+    note_local(value);
+    break;
+  case dkind_LoadStack:
+    emit_rm(FALSE, 0x8B, R_11, R_DI, offsetof(jitregs_t, valstackbase));
+    emit_ri(0, R_11, 4); /* add r11d, 4 */
+    emit_rr(FALSE, 0x39, R_11, R_9); /* cmp r9d, r11d */
+    add_fixup(emit_jump(cc_B), fixup_Bail, dec->addr);
+    emit_ri(5, R_9, 4); /* sub r9d, 4 */
+    emit_rx(0x8B, reg, R_8, R_9, 0);
+    break;
+  }
+}
+
+/* Store eax into the given store operand. */
+static void emit_store(decodedinst_t *dec, int ix)
+{
+  glui32 value = dec->values[ix];
+
+  switch (dec->kinds[ix] - dkind_Store) {
+  case 0:
+    break;
+  case 1:
+  case 4:
+    emit_mov_imm(R_11, value);
+    emit_check_watch(dec->addr);
+    emit_bswap(R_AX);
+    emit_rm(FALSE, 0x89, R_AX, R_SI, value);
+    break;
+  case 2:
+    emit_rm(FALSE, 0x89, R_AX, R_10, value);
+    note_local(value);
+    break;
+  case 3:
+    emit_rm(FALSE, 0x8D, R_11, R_9, 4); /* lea r11d, [r9+4] */
+    emit_rm(FALSE, 0x3B, R_11, R_DI, offsetof(jitregs_t, stacksize));
+    add_fixup(emit_jump(cc_A), fixup_Bail, dec->addr);
+    emit_rx(0x89, R_AX, R_8, R_9, 0);
+    emit_ri(0, R_9, 4); /* add r9d, 4 */
+    break;
+  }
+}
+
+/* Emit a jump to the given Glulx address: within the block if we can,
+   otherwise out of it. If cc is -1, the jump is unconditional. */
+static void emit_branch(int cc, glui32 dest)
+{
+  int ix;
+  unsigned char *skip = NULL;
+
+  for (ix=0; ix<numinsts; ix++) {
+    if (instaddrs[ix] == dest)
+      break;
+  }
+
+  if (ix < numinsts) {
+    /* A backward jump within the block. Count it against the loop
+       budget. */
+    if (cc >= 0)
+      skip = emit_jump(cc ^ 1);
+    emit_rm(FALSE, 0xFF, 1, R_DI, offsetof(jitregs_t, budget)); /* dec */
+    add_fixup(emit_jump(cc_E), fixup_Exit, dest);
+    patch_jump(emit_jump(-1), instcode[ix]);
+    if (skip)
+      patch_jump(skip, emitptr);
+  }
+  else {
+    add_fixup(emit_jump(cc), fixup_Branch, dest);
+  }
+}
+
+/* can_compile():
+   Decide whether we can translate the given instruction. (The operand
+   kinds have to make sense, too.)
+*/
+static int can_compile(decodedinst_t *dec)
+{
+  int ix;
+  int numops = dec->oplist->num_ops;
+  int isbranch = FALSE;
+
+  switch (dec->opcode) {
+  case op_nop:
+  case op_add:
+  case op_sub:
+  case op_mul:
+  case op_neg:
+  case op_bitand:
+  case op_bitor:
+  case op_bitxor:
+  case op_bitnot:
+  case op_shiftl:
+  case op_ushiftr:
+  case op_sshiftr:
+  case op_copy:
+  case op_sexs:
+  case op_sexb:
+  case op_aload:
+  case op_aloads:
+  case op_aloadb:
+  case op_astore:
+  case op_astores:
+  case op_astoreb:
+    break;
+  case op_jump:
+  case op_jz:
+  case op_jnz:
+  case op_jeq:
+  case op_jne:
+  case op_jlt:
+  case op_jge:
+  case op_jgt:
+  case op_jle:
+  case op_jltu:
+  case op_jgeu:
+  case op_jgtu:
+  case op_jleu:
+    isbranch = TRUE;
+    break;
+  default:
+    return FALSE;
+  }
+
+  if (dec->oplist->arg_size != 4)
+    return FALSE;
+
+  for (ix=0; ix<numops; ix++) {
+    glui32 value = dec->values[ix];
+    switch (dec->kinds[ix]) {
+    case dkind_LoadConst:
+    case dkind_LoadStack:
+    case dkind_Store+0:
+    case dkind_Store+3:
+      break;
+    case dkind_LoadMem:
+    case dkind_LoadMemVerified:
+      if (!fixed_address_ok(value, FALSE))
+        return FALSE;
+      break;
+    case dkind_Store+1:
+    case dkind_Store+4:
+      if (!fixed_address_ok(value, TRUE))
+        return FALSE;
+      break;
+    case dkind_LoadLocal:
+    case dkind_Store+2:
+      if (!local_offset_ok(value))
+        return FALSE;
+      break;
+    default:
+      return FALSE;
+    }
+  }
+
+  if (isbranch) {
+    /* Branches that return from the function (offset 0 or 1), or
+       whose offsets aren't constant, are left to the interpreter. */
+    ix = numops-1;
+    if (dec->kinds[ix] != dkind_LoadConst)
+      return FALSE;
+    if (dec->values[ix] == 0 || dec->values[ix] == 1)
+      return FALSE;
+  }
+
+  return TRUE;
+}
+
+/* compile_instruction():
+   Emit the code for one instruction, which has passed can_compile().
+   Returns TRUE if execution can fall through to the next instruction.
+*/
+static int compile_instruction(decodedinst_t *dec)
+{
+  static const int loadregs[3] = { R_AX, R_CX, R_DX };
+  int ix;
+  int numops = dec->oplist->num_ops;
+  int numloads = numops;
+  int hasstore = FALSE;
+  int cc = -1;
+  glui32 dest = 0;
+  glui32 addr = dec->addr;
+
+  switch (dec->opcode) {
+  case op_jump:
+  case op_jz:
+  case op_jnz:
+  case op_jeq:
+  case op_jne:
+  case op_jlt:
+  case op_jge:
+  case op_jgt:
+  case op_jle:
+  case op_jltu:
+  case op_jgeu:
+  case op_jgtu:
+  case op_jleu:
+    numloads--;
+    dest = dec->nextaddr + dec->values[numops-1] - 2;
+    break;
+  default:
+    if (numops && dec->kinds[numops-1] >= dkind_Store) {
+      numloads--;
+      hasstore = TRUE;
+    }
+    break;
+  }
+
+  /* Note the stack pointer, in case we have to bail out. */
+  emit_rr(FALSE, 0x89, R_9, R_BX); /* mov ebx, r9d */
+
+  for (ix=0; ix<numloads; ix++)
+    emit_load(dec, ix, loadregs[ix]);
+
+  switch (dec->opcode) {
+  case op_nop:
+  case op_copy:
+    break;
+  case op_add:
+    emit_rr(FALSE, 0x01, R_CX, R_AX);
+    break;
+  case op_sub:
+    emit_rr(FALSE, 0x29, R_CX, R_AX);
+    break;
+  case op_mul:
+    emit_rr(FALSE, 0x0FAF, R_AX, R_CX);
+    break;
+  case op_neg:
+    emit_rr(FALSE, 0xF7, 3, R_AX);
+    break;
+  case op_bitand:
+    emit_rr(FALSE, 0x21, R_CX, R_AX);
+    break;
+  case op_bitor:
+    emit_rr(FALSE, 0x09, R_CX, R_AX);
+    break;
+  case op_bitxor:
+    emit_rr(FALSE, 0x31, R_CX, R_AX);
+    break;
+  case op_bitnot:
+    emit_rr(FALSE, 0xF7, 2, R_AX);
+    break;
+  case op_shiftl:
+  case op_ushiftr:
+    /* The x86 shift uses only the low five bits of cl. Glulx shifts of
+       32 or more produce zero, so we mask the result with (cl < 32). */
+    emit_ri(7, R_CX, 32); /* cmp ecx, 32 */
+    emit_rr(FALSE, 0x19, R_DX, R_DX); /* sbb edx, edx */
+    emit_rr(FALSE, 0xD3, (dec->opcode == op_shiftl) ? 4 : 5, R_AX);
+    emit_rr(FALSE, 0x21, R_DX, R_AX);
+    break;
+  case op_sshiftr:
+    /* Signed shifts of 32 or more are the same as shifting by 31. */
+    emit_mov_imm(R_DX, 31);
+    emit_rr(FALSE, 0x39, R_DX, R_CX); /* cmp ecx, edx */
+    emit_rr(FALSE, 0x0F47, R_CX, R_DX); /* cmova ecx, edx */
+    emit_rr(FALSE, 0xD3, 7, R_AX);
+    break;
+  case op_sexs:
+    emit_rr(FALSE, 0x0FBF, R_AX, R_AX);
+    break;
+  case op_sexb:
+    emit_rr(FALSE, 0x0FBE, R_AX, R_AX);
+    break;
+  case op_aload:
+    emit_rx(0x8D, R_AX, R_AX, R_CX, 2); /* lea eax, [rax+rcx*4] */
+    emit_check_memory(addr, 4, FALSE);
+    emit_rx(0x8B, R_AX, R_SI, R_AX, 0);
+    emit_bswap(R_AX);
+    break;
+  case op_aloads:
+    emit_rx(0x8D, R_AX, R_AX, R_CX, 1);
+    emit_check_memory(addr, 2, FALSE);
+    emit_rx(0x0FB7, R_AX, R_SI, R_AX, 0); /* movzx */
+    emit_bswap(R_AX);
+    emit_rr(FALSE, 0xC1, 5, R_AX); /* shr eax, 16 */
+    emit1(16);
+    break;
+  case op_aloadb:
+    emit_rx(0x8D, R_AX, R_AX, R_CX, 0);
+    emit_check_memory(addr, 1, FALSE);
+    emit_rx(0x0FB6, R_AX, R_SI, R_AX, 0); /* movzx */
+    break;
+  case op_astore:
+    emit_rx(0x8D, R_AX, R_AX, R_CX, 2);
+    emit_check_memory(addr, 4, TRUE);
+    emit_bswap(R_DX);
+    emit_rx(0x89, R_DX, R_SI, R_AX, 0);
+    break;
+  case op_astores:
+    emit_rx(0x8D, R_AX, R_AX, R_CX, 1);
+    emit_check_memory(addr, 2, TRUE);
+    emit1(0x66);
+    emit_rr(FALSE, 0xC1, 0, R_DX); /* rol dx, 8 */
+    emit1(8);
+    emit1(0x66);
+    emit_rx(0x89, R_DX, R_SI, R_AX, 0);
+    break;
+  case op_astoreb:
+    emit_rx(0x8D, R_AX, R_AX, R_CX, 0);
+    emit_check_memory(addr, 1, TRUE);
+    emit_rx(0x88, R_DX, R_SI, R_AX, 0);
+    break;
+
+  case op_jump:
+    emit_branch(-1, dest);
+    return FALSE;
+  case op_jz:
+    cc = cc_E;
+    break;
+  case op_jnz:
+    cc = cc_NE;
+    break;
+  case op_jeq:
+    cc = cc_E;
+    break;
+  case op_jne:
+    cc = cc_NE;
+    break;
+  case op_jlt:
+    cc = cc_L;
+    break;
+  case op_jge:
+    cc = cc_GE;
+    break;
+  case op_jgt:
+    cc = cc_G;
+    break;
+  case op_jle:
+    cc = cc_LE;
+    break;
+  case op_jltu:
+    cc = cc_B;
+    break;
+  case op_jgeu:
+    cc = cc_AE;
+    break;
+  case op_jgtu:
+    cc = cc_A;
+    break;
+  case op_jleu:
+    cc = cc_BE;
+    break;
+  }
+
+  if (cc >= 0) {
+    if (numloads == 1)
+      emit_rr(FALSE, 0x85, R_AX, R_AX); /* test eax, eax */
+    else
+      emit_rr(FALSE, 0x39, R_CX, R_AX); /* cmp eax, ecx */
+    emit_branch(cc, dest);
+  }
+
+  if (hasstore)
+    emit_store(dec, numops-1);
+
+  return TRUE;
+}
+
+/* compile_block():
+   Translate the code starting at startaddr. Returns NULL if not even
+   the first instruction can be translated, or if the arena is full.
+   (In the latter case, the arena is flushed.) If the arena's protection
+   can't be changed, this shuts down the JIT (blocktable becomes NULL).
+*/
+static jitfunc_t compile_block(glui32 startaddr)
+{
+  unsigned char *start = emitptr;
+  glui32 addr = startaddr;
+  int fallthrough = TRUE;
+  decodedinst_t dec;
+  int ix, jx;
+
+  numinsts = 0;
+  numfixups = 0;
+  localsneeded = 0;
+
+  if (arenaend - emitptr < 4*JIT_INST_ROOM) {
+    flush_jit();
+    return NULL;
+  }
+
+  if (!protect_arena(start, TRUE)) {
+    final_jit();
+    return NULL;
+  }
+
+  /* Prologue. */
+  emit1(0x50 | R_BX); /* push rbx */
+  emit_rm(TRUE, 0x8B, R_SI, R_DI, offsetof(jitregs_t, memmap));
+  emit_rm(TRUE, 0x8B, R_8, R_DI, offsetof(jitregs_t, stack));
+  emit_rm(TRUE, 0x8B, R_10, R_DI, offsetof(jitregs_t, locals));
+  emit_rm(FALSE, 0x8B, R_9, R_DI, offsetof(jitregs_t, stackptr));
+
+  while (numinsts < JIT_MAX_INSTS && numfixups < JIT_MAX_FIXUPS-8) {
+    /* Leave room for this instruction, and the stubs for every fixup
+       so far (and its own). */
+    if (arenaend - emitptr < JIT_INST_ROOM
+      + (numfixups+8) * JIT_STUB_ROOM)
+      break;
+    /* Stay well clear of the end of ROM, so that decoding can't
+       run off it. */
+    if (addr >= ramstart || ramstart - addr < 64)
+      break;
+    if (!decode_instruction(&dec, addr) || !can_compile(&dec))
+      break;
+
+    instaddrs[numinsts] = addr;
+    instcode[numinsts] = emitptr;
+    numinsts++;
+    addr = dec.nextaddr;
+
+    fallthrough = compile_instruction(&dec);
+    if (!fallthrough) {
+      /* After an unconditional jump, keep going only if some earlier
+         branch lands on the next instruction. */
+      for (ix=0; ix<numfixups; ix++) {
+        if (fixups[ix].kind == fixup_Branch && fixups[ix].addr == addr)
+          break;
+      }
+      if (ix >= numfixups)
+        break;
+      fallthrough = TRUE;
+    }
+  }
+
+  if (numinsts == 0) {
+    emitptr = start;
+    if (!protect_arena(start, FALSE))
+      final_jit();
+    return NULL;
+  }
+
+  if (fallthrough) {
+    emit_mov_imm(R_AX, addr);
+    emit_exit();
+  }
+
+  /* Resolve the fixups. Branches to an instruction in the block jump
+     there; everything else gets a stub that leaves the block. */
+  for (ix=0; ix<numfixups; ix++) {
+    jitfixup_t *fix = &(fixups[ix]);
+    if (fix->kind == fixup_Branch) {
+      for (jx=0; jx<numinsts; jx++) {
+        if (instaddrs[jx] == fix->addr)
+          break;
+      }
+      if (jx < numinsts) {
+        patch_jump(fix->pos, instcode[jx]);
+        continue;
+      }
+    }
+    patch_jump(fix->pos, emitptr);
+    if (fix->kind == fixup_Bail)
+      emit_rr(FALSE, 0x89, R_BX, R_9); /* mov r9d, ebx */
+    emit_mov_imm(R_AX, fix->addr);
+    emit_exit();
+  }
+
+  if (!protect_arena(start, FALSE)) {
+    final_jit();
+    return NULL;
+  }
+
+  return (jitfunc_t)start;
+}
+
+#endif /* JIT_COMPILER */
@@ -11,10 +11,19 @@ strid_t gamefile = NULL; /* The stream containing the Glulx file. */
 glui32 gamefile_start = 0; /* The position within the stream. (This will not 
     be zero if the Glulx file is a chunk inside a Blorb archive.) */
 glui32 gamefile_len = 0; /* The length within the stream. */
+char *gamefile_pathname = NULL; /* The file's pathname, if the startup
+    code knows it. */
 char *init_err = NULL;
 char *init_err2 = NULL;
 
 glui32 init_rng_seed = 0;
+#ifdef CACHE_STATS
+int pref_cache_stats = FALSE;
+#endif /* CACHE_STATS */
+
+/* How many instructions execute_loop() runs between calls to glk_tick().
+   The Unix startup code lets you set this with --tickinterval. */
+glui32 tick_interval = 1;
 
 /* The library_start_hook is called at the beginning of glk_main. This
    is not normally necessary -- the library can do all its setup work
@@ -26,8 +35,17 @@ static void (*library_start_hook)(void) = NULL;
    state, if the library has that capability. (Currently, only iosglk
    and remglk do.) */
 static void (*library_autorestore_hook)(void) = NULL;
+/* The library_fork_hook is called after the VM's initial setup, before
+   the autorestore hook. The Unix fork server uses it to wait for
+   connections; it only returns in a child process, which then goes on
+   to run the game. */
+static void (*library_fork_hook)(void) = NULL;
 
 static winid_t get_error_win(void);
+#ifdef CACHE_STATS
+static void show_cache_stats(void);
+static void stream_decnum(glui32 val);
+#endif /* CACHE_STATS */
 static void stream_hexnum(glsi32 val);
 
 /* glk_main():
@@ -64,15 +82,33 @@ void glk_main()
     return;
   }
 
+#ifdef GUARD_MEMORY_ACCESS
+  /* A guard-page fault lands here. (See guard_handler() in osdepend.c.) */
+  if (sigsetjmp(guard_fault_jmp, 1)) {
+    guard_fault_armed = FALSE;
+    fatal_error_i("Memory access out of range", guard_fault_addr);
+    return;
+  }
+  guard_fault_armed = TRUE;
+#endif /* GUARD_MEMORY_ACCESS */
+
   setup_vm();
+  if (library_fork_hook)
+    library_fork_hook();
   if (library_autorestore_hook)
     library_autorestore_hook();
   execute_loop();
+  stream_flush();
+#ifdef CACHE_STATS
+  if (pref_cache_stats)
+    show_cache_stats();
+#endif /* CACHE_STATS */
   finalize_vm();
 
   gamefile = NULL;
   gamefile_start = 0;
   gamefile_len = 0;
+  gamefile_pathname = NULL;
   init_err = NULL;
   vm_exited_cleanly = TRUE;
   
@@ -90,6 +126,66 @@ void set_library_autorestore_hook(void (*func)(void))
   library_autorestore_hook = func;
 }
 
+void set_library_fork_hook(void (*func)(void))
+{
+  library_fork_hook = func;
+}
+
+#ifdef CACHE_STATS
+
+/* show_cache_stats():
+   Display the hit and miss counts of the interpreter's caches, in the
+   error window. This is for checking that the caches are doing their
+   job on a particular game.
+*/
+static void show_cache_stats()
+{
+  winid_t win;
+  strid_t oldstr;
+
+  win = get_error_win();
+  if (!win)
+    return;
+
+  oldstr = glk_stream_get_current();
+  glk_set_window(win);
+  glk_put_string("Call cache: ");
+  stream_decnum(call_cache_hits);
+  glk_put_string(" hits, ");
+  stream_decnum(call_cache_misses);
+  glk_put_string(" misses\n");
+  glk_put_string("Function cache: ");
+  stream_decnum(func_cache_hits);
+  glk_put_string(" hits, ");
+  stream_decnum(func_cache_misses);
+  glk_put_string(" misses\n");
+  glk_stream_set_current(oldstr);
+}
+
+/* stream_decnum():
+   Write an unsigned integer, in decimal, to the current Glk output
+   stream.
+*/
+static void stream_decnum(glui32 val)
+{
+  char buf[16];
+  int ix;
+
+  ix = 0;
+  do {
+    buf[ix] = (val % 10) + '0';
+    ix++;
+    val /= 10;
+  } while (val != 0);
+
+  while (ix) {
+    ix--;
+    glk_put_char(buf[ix]);
+  }
+}
+
+#endif /* CACHE_STATS */
+
 /* get_error_win():
    Return a window in which to display errors. The first time this is called,
    it creates a new window; after that it returns the window it first
@@ -127,6 +223,7 @@ void fatal_error_handler(char *str, char *arg, int useval, glsi32 val)
      preferences. */
   debugger_handle_crash(str);
 
+  stream_flush();
   win = get_error_win();
   if (win) {
     glk_set_window(win);
@@ -152,7 +249,10 @@ void fatal_error_handler(char *str, char *arg, int useval, glsi32 val)
 */
 void nonfatal_warning_handler(char *str, char *arg, int useval, glsi32 val)
 {
-  winid_t win = get_error_win();
+  winid_t win;
+
+  stream_flush();
+  win = get_error_win();
   if (win) {
     strid_t oldstr = glk_stream_get_current();
     glk_set_window(win);
@@ -7,8 +7,245 @@
 #include "glulxe.h"
 #include "opcodes.h"
 
-/* ### We could save a few cycles per operand by generating a function for
-   each operandlist type. */
+static glui32 parse_load_operand(int mode, int argsize);
+static void parse_store_operand(oparg_t *arg, int mode);
+
+/* The operand parsers. Each of these handles a single operandlist
+   type, with the number of operands, their forms, and the argument
+   size fixed, so that execute_loop() can call it without going
+   through the general loop in parse_operands(). The PARSE macros are
+   the steps of that loop, unrolled.
+
+   PARSE_LOAD handles the most common load modes (small constants,
+   stack pops, and one-byte locals) in line. Anything else, including
+   a stack underflow, goes to parse_load_operand(). */
+
+#define PARSE_BEGIN(numops)  \
+  glui32 modeaddr = pc;  \
+  int modeval = 0;  \
+  pc += ((numops)+1) / 2
+#define PARSE_MODE(ix)  \
+  (((ix) & 1) ? ((modeval >> 4) & 0x0F)  \
+    : ((modeval = Mem1(modeaddr+((ix) >> 1))) & 0x0F))
+#define PARSE_LOAD(ix, argsize)  \
+  do {  \
+    int mode = PARSE_MODE(ix);  \
+    args[ix].desttype = 0;  \
+    if (mode == 0) {  \
+      args[ix].value = 0;  \
+    }  \
+    else if (mode == 1) {  \
+      args[ix].value = (glsi32)(signed char)(Mem1(pc));  \
+      pc++;  \
+    }  \
+    else if (mode == 8 && stackptr >= valstackbase+4) {  \
+      stackptr -= 4;  \
+      args[ix].value = Stk4(stackptr);  \
+    }  \
+    else if (mode == 9) {  \
+      glui32 addr = localsbase + Mem1(pc);  \
+      pc++;  \
+      if ((argsize) == 4)  \
+        args[ix].value = Stk4(addr);  \
+      else if ((argsize) == 2)  \
+        args[ix].value = Stk2(addr);  \
+      else  \
+        args[ix].value = Stk1(addr);  \
+    }  \
+    else {  \
+      args[ix].value = parse_load_operand(mode, (argsize));  \
+    }  \
+  } while (0)
+#define PARSE_STORE(ix)  \
+  parse_store_operand(&(args[ix]), PARSE_MODE(ix))
+
+static void parse_none(oparg_t *args)
+{
+}
+
+static void parse_S(oparg_t *args)
+{
+  PARSE_BEGIN(1);
+  PARSE_STORE(0);
+}
+
+static void parse_LS(oparg_t *args)
+{
+  PARSE_BEGIN(2);
+  PARSE_LOAD(0, 4);
+  PARSE_STORE(1);
+}
+
+static void parse_LLS(oparg_t *args)
+{
+  PARSE_BEGIN(3);
+  PARSE_LOAD(0, 4);
+  PARSE_LOAD(1, 4);
+  PARSE_STORE(2);
+}
+
+static void parse_LLLS(oparg_t *args)
+{
+  PARSE_BEGIN(4);
+  PARSE_LOAD(0, 4);
+  PARSE_LOAD(1, 4);
+  PARSE_LOAD(2, 4);
+  PARSE_STORE(3);
+}
+
+static void parse_LLLLS(oparg_t *args)
+{
+  PARSE_BEGIN(5);
+  PARSE_LOAD(0, 4);
+  PARSE_LOAD(1, 4);
+  PARSE_LOAD(2, 4);
+  PARSE_LOAD(3, 4);
+  PARSE_STORE(4);
+}
+
+static void parse_LLLLLLS(oparg_t *args)
+{
+  PARSE_BEGIN(7);
+  PARSE_LOAD(0, 4);
+  PARSE_LOAD(1, 4);
+  PARSE_LOAD(2, 4);
+  PARSE_LOAD(3, 4);
+  PARSE_LOAD(4, 4);
+  PARSE_LOAD(5, 4);
+  PARSE_STORE(6);
+}
+
+static void parse_LLLLLLLS(oparg_t *args)
+{
+  PARSE_BEGIN(8);
+  PARSE_LOAD(0, 4);
+  PARSE_LOAD(1, 4);
+  PARSE_LOAD(2, 4);
+  PARSE_LOAD(3, 4);
+  PARSE_LOAD(4, 4);
+  PARSE_LOAD(5, 4);
+  PARSE_LOAD(6, 4);
+  PARSE_STORE(7);
+}
+
+static void parse_L(oparg_t *args)
+{
+  PARSE_BEGIN(1);
+  PARSE_LOAD(0, 4);
+}
+
+static void parse_LL(oparg_t *args)
+{
+  PARSE_BEGIN(2);
+  PARSE_LOAD(0, 4);
+  PARSE_LOAD(1, 4);
+}
+
+static void parse_LLL(oparg_t *args)
+{
+  PARSE_BEGIN(3);
+  PARSE_LOAD(0, 4);
+  PARSE_LOAD(1, 4);
+  PARSE_LOAD(2, 4);
+}
+
+static void parse_2LS(oparg_t *args)
+{
+  PARSE_BEGIN(2);
+  PARSE_LOAD(0, 2);
+  PARSE_STORE(1);
+}
+
+static void parse_1LS(oparg_t *args)
+{
+  PARSE_BEGIN(2);
+  PARSE_LOAD(0, 1);
+  PARSE_STORE(1);
+}
+
+static void parse_LLLL(oparg_t *args)
+{
+  PARSE_BEGIN(4);
+  PARSE_LOAD(0, 4);
+  PARSE_LOAD(1, 4);
+  PARSE_LOAD(2, 4);
+  PARSE_LOAD(3, 4);
+}
+
+static void parse_LLLLL(oparg_t *args)
+{
+  PARSE_BEGIN(5);
+  PARSE_LOAD(0, 4);
+  PARSE_LOAD(1, 4);
+  PARSE_LOAD(2, 4);
+  PARSE_LOAD(3, 4);
+  PARSE_LOAD(4, 4);
+}
+
+static void parse_LLLLLL(oparg_t *args)
+{
+  PARSE_BEGIN(6);
+  PARSE_LOAD(0, 4);
+  PARSE_LOAD(1, 4);
+  PARSE_LOAD(2, 4);
+  PARSE_LOAD(3, 4);
+  PARSE_LOAD(4, 4);
+  PARSE_LOAD(5, 4);
+}
+
+static void parse_LLLLLLL(oparg_t *args)
+{
+  PARSE_BEGIN(7);
+  PARSE_LOAD(0, 4);
+  PARSE_LOAD(1, 4);
+  PARSE_LOAD(2, 4);
+  PARSE_LOAD(3, 4);
+  PARSE_LOAD(4, 4);
+  PARSE_LOAD(5, 4);
+  PARSE_LOAD(6, 4);
+}
+
+static void parse_SL(oparg_t *args)
+{
+  PARSE_BEGIN(2);
+  PARSE_STORE(0);
+  PARSE_LOAD(1, 4);
+}
+
+static void parse_SS(oparg_t *args)
+{
+  PARSE_BEGIN(2);
+  PARSE_STORE(0);
+  PARSE_STORE(1);
+}
+
+static void parse_LSS(oparg_t *args)
+{
+  PARSE_BEGIN(3);
+  PARSE_LOAD(0, 4);
+  PARSE_STORE(1);
+  PARSE_STORE(2);
+}
+
+static void parse_LLSS(oparg_t *args)
+{
+  PARSE_BEGIN(4);
+  PARSE_LOAD(0, 4);
+  PARSE_LOAD(1, 4);
+  PARSE_STORE(2);
+  PARSE_STORE(3);
+}
+
+static void parse_LLLLSS(oparg_t *args)
+{
+  PARSE_BEGIN(6);
+  PARSE_LOAD(0, 4);
+  PARSE_LOAD(1, 4);
+  PARSE_LOAD(2, 4);
+  PARSE_LOAD(3, 4);
+  PARSE_STORE(4);
+  PARSE_STORE(5);
+}
 
 /* fast_operandlist[]:
    This is a handy array in which to look up operandlists quickly.
@@ -19,51 +256,51 @@ const operandlist_t *fast_operandlist[0x80];
 
 /* The actual immutable structures which lookup_operandlist()
    returns. */
-static operandlist_t list_none = { 0, 4, NULL };
+static operandlist_t list_none = { 0, 4, NULL, parse_none };
 
 static int array_S[1] = { modeform_Store };
-static operandlist_t list_S = { 1, 4, array_S };
+static operandlist_t list_S = { 1, 4, array_S, parse_S };
 static int array_LS[2] = { modeform_Load, modeform_Store };
-static operandlist_t list_LS = { 2, 4, array_LS };
+static operandlist_t list_LS = { 2, 4, array_LS, parse_LS };
 static int array_LLS[3] = { modeform_Load, modeform_Load, modeform_Store };
-static operandlist_t list_LLS = { 3, 4, array_LLS };
+static operandlist_t list_LLS = { 3, 4, array_LLS, parse_LLS };
 static int array_LLLS[4] = { modeform_Load, modeform_Load, modeform_Load, modeform_Store };
-static operandlist_t list_LLLS = { 4, 4, array_LLLS };
+static operandlist_t list_LLLS = { 4, 4, array_LLLS, parse_LLLS };
 static int array_LLLLS[5] = { modeform_Load, modeform_Load, modeform_Load, modeform_Load, modeform_Store };
-static operandlist_t list_LLLLS = { 5, 4, array_LLLLS };
+static operandlist_t list_LLLLS = { 5, 4, array_LLLLS, parse_LLLLS };
 /* static int array_LLLLLS[6] = { modeform_Load, modeform_Load, modeform_Load, modeform_Load, modeform_Load, modeform_Store };
 static operandlist_t list_LLLLLS = { 6, 4, array_LLLLLS }; */ /* not currently used */
 static int array_LLLLLLS[7] = { modeform_Load, modeform_Load, modeform_Load, modeform_Load, modeform_Load, modeform_Load, modeform_Store };
-static operandlist_t list_LLLLLLS = { 7, 4, array_LLLLLLS };
+static operandlist_t list_LLLLLLS = { 7, 4, array_LLLLLLS, parse_LLLLLLS };
 static int array_LLLLLLLS[8] = { modeform_Load, modeform_Load, modeform_Load, modeform_Load, modeform_Load, modeform_Load, modeform_Load, modeform_Store };
-static operandlist_t list_LLLLLLLS = { 8, 4, array_LLLLLLLS };
+static operandlist_t list_LLLLLLLS = { 8, 4, array_LLLLLLLS, parse_LLLLLLLS };
 
 static int array_L[1] = { modeform_Load };
-static operandlist_t list_L = { 1, 4, array_L };
+static operandlist_t list_L = { 1, 4, array_L, parse_L };
 static int array_LL[2] = { modeform_Load, modeform_Load };
-static operandlist_t list_LL = { 2, 4, array_LL };
+static operandlist_t list_LL = { 2, 4, array_LL, parse_LL };
 static int array_LLL[3] = { modeform_Load, modeform_Load, modeform_Load };
-static operandlist_t list_LLL = { 3, 4, array_LLL };
-static operandlist_t list_2LS = { 2, 2, array_LS };
-static operandlist_t list_1LS = { 2, 1, array_LS };
+static operandlist_t list_LLL = { 3, 4, array_LLL, parse_LLL };
+static operandlist_t list_2LS = { 2, 2, array_LS, parse_2LS };
+static operandlist_t list_1LS = { 2, 1, array_LS, parse_1LS };
 static int array_LLLL[4] = { modeform_Load, modeform_Load, modeform_Load, modeform_Load };
-static operandlist_t list_LLLL = { 4, 4, array_LLLL };
+static operandlist_t list_LLLL = { 4, 4, array_LLLL, parse_LLLL };
 static int array_LLLLL[5] = { modeform_Load, modeform_Load, modeform_Load, modeform_Load, modeform_Load };
-static operandlist_t list_LLLLL = { 5, 4, array_LLLLL };
+static operandlist_t list_LLLLL = { 5, 4, array_LLLLL, parse_LLLLL };
 static int array_LLLLLL[6] = { modeform_Load, modeform_Load, modeform_Load, modeform_Load, modeform_Load, modeform_Load };
-static operandlist_t list_LLLLLL = { 6, 4, array_LLLLLL };
+static operandlist_t list_LLLLLL = { 6, 4, array_LLLLLL, parse_LLLLLL };
 static int array_LLLLLLL[7] = { modeform_Load, modeform_Load, modeform_Load, modeform_Load, modeform_Load, modeform_Load, modeform_Load };
-static operandlist_t list_LLLLLLL = { 7, 4, array_LLLLLLL };
+static operandlist_t list_LLLLLLL = { 7, 4, array_LLLLLLL, parse_LLLLLLL };
 static int array_SL[2] = { modeform_Store, modeform_Load };
-static operandlist_t list_SL = { 2, 4, array_SL };
+static operandlist_t list_SL = { 2, 4, array_SL, parse_SL };
 static int array_SS[2] = { modeform_Store, modeform_Store };
-static operandlist_t list_SS = { 2, 4, array_SS };
+static operandlist_t list_SS = { 2, 4, array_SS, parse_SS };
 static int array_LSS[3] = { modeform_Load, modeform_Store, modeform_Store };
-static operandlist_t list_LSS = { 3, 4, array_LSS };
+static operandlist_t list_LSS = { 3, 4, array_LSS, parse_LSS };
 static int array_LLSS[4] = { modeform_Load, modeform_Load, modeform_Store, modeform_Store };
-static operandlist_t list_LLSS = { 4, 4, array_LLSS };
+static operandlist_t list_LLSS = { 4, 4, array_LLSS, parse_LLSS };
 static int array_LLLLSS[6] = { modeform_Load, modeform_Load, modeform_Load, modeform_Load, modeform_Store, modeform_Store };
-static operandlist_t list_LLLLSS = { 6, 4, array_LLLLSS };
+static operandlist_t list_LLLLSS = { 6, 4, array_LLLLSS, parse_LLLLSS };
 
 /* init_operands():
    Set up the fast-lookup array of operandlists. This is called just
@@ -341,6 +578,236 @@ const operandlist_t *lookup_operandlist(glui32 opcode)
   }
 }
 
+/* parse_load_operand():
+   Read one load operand, given its addressing mode, and return its
+   value. This assumes that the PC is at the operand's immediate data
+   (if any); upon return, the PC is past it.
+*/
+static glui32 parse_load_operand(int mode, int argsize)
+{
+  glui32 value;
+  glui32 addr;
+
+  switch (mode) {
+
+  case 8: /* pop off stack */
+    if (stackptr < valstackbase+4) {
+      fatal_error("Stack underflow in operand.");
+    }
+    stackptr -= 4;
+    value = Stk4(stackptr);
+    break;
+
+  case 0: /* constant zero */
+    value = 0;
+    break;
+
+  case 1: /* one-byte constant */
+    /* Sign-extend from 8 bits to 32 */
+    value = (glsi32)(signed char)(Mem1(pc));
+    pc++;
+    break;
+
+  case 2: /* two-byte constant */
+    /* Sign-extend the first byte from 8 bits to 32; the subsequent
+       byte must not be sign-extended. */
+    value = (glsi32)(signed char)(Mem1(pc));
+    pc++;
+    value = (value << 8) | (glui32)(Mem1(pc));
+    pc++;
+    break;
+
+  case 3: /* four-byte constant */
+    /* Bytes must not be sign-extended. */
+    value = Mem4(pc);
+    pc += 4;
+    break;
+
+  case 15: /* main memory RAM, four-byte address */
+    addr = Mem4(pc);
+    addr += ramstart;
+    pc += 4;
+    goto MainMemAddr; 
+
+  case 14: /* main memory RAM, two-byte address */
+    addr = (glui32)Mem2(pc);
+    addr += ramstart;
+    pc += 2;
+    goto MainMemAddr; 
+
+  case 13: /* main memory RAM, one-byte address */
+    addr = (glui32)(Mem1(pc));
+    addr += ramstart;
+    pc++;
+    goto MainMemAddr; 
+    
+  case 7: /* main memory, four-byte address */
+    addr = Mem4(pc);
+    pc += 4;
+    goto MainMemAddr;
+
+  case 6: /* main memory, two-byte address */
+    addr = (glui32)Mem2(pc);
+    pc += 2;
+    goto MainMemAddr;
+
+  case 5: /* main memory, one-byte address */
+    addr = (glui32)(Mem1(pc));
+    pc++;
+    /* fall through */
+
+  MainMemAddr:
+    /* cases 5, 6, 7, 13, 14, 15 all wind up here. */
+    if (argsize == 4) {
+      value = Mem4(addr);
+    }
+    else if (argsize == 2) {
+      value = Mem2(addr);
+    }
+    else {
+      value = Mem1(addr);
+    }
+    break;
+
+  case 11: /* locals, four-byte address */
+    addr = Mem4(pc);
+    pc += 4;
+    goto LocalsAddr;
+
+  case 10: /* locals, two-byte address */
+    addr = (glui32)Mem2(pc);
+    pc += 2;
+    goto LocalsAddr; 
+
+  case 9: /* locals, one-byte address */
+    addr = (glui32)(Mem1(pc));
+    pc++;
+    /* fall through */
+
+  LocalsAddr:
+    /* cases 9, 10, 11 all wind up here. It's illegal for addr to not
+       be four-byte aligned, but we don't check this explicitly. 
+       A "strict mode" interpreter probably should. It's also illegal
+       for addr to be less than zero or greater than the size of
+       the locals segment. */
+    addr += localsbase;
+    if (argsize == 4) {
+      value = Stk4(addr);
+    }
+    else if (argsize == 2) {
+      value = Stk2(addr);
+    }
+    else {
+      value = Stk1(addr);
+    }
+    break;
+
+  default:
+    value = 0;
+    fatal_error("Unknown addressing mode in load operand.");
+  }
+
+  return value;
+}
+
+/* parse_store_operand():
+   Read one store operand, given its addressing mode, and fill in the
+   destination in arg. As with parse_load_operand(), the PC moves past
+   the operand's immediate data.
+*/
+static void parse_store_operand(oparg_t *arg, int mode)
+{
+  glui32 addr;
+
+  switch (mode) {
+
+  case 0: /* discard value */
+    arg->desttype = 0;
+    arg->value = 0;
+    break;
+
+  case 8: /* push on stack */
+    arg->desttype = 3;
+    arg->value = 0;
+    break;
+
+  case 15: /* main memory RAM, four-byte address */
+    addr = Mem4(pc);
+    addr += ramstart;
+    pc += 4;
+    goto WrMainMemAddr; 
+
+  case 14: /* main memory RAM, two-byte address */
+    addr = (glui32)Mem2(pc);
+    addr += ramstart;
+    pc += 2;
+    goto WrMainMemAddr; 
+
+  case 13: /* main memory RAM, one-byte address */
+    addr = (glui32)(Mem1(pc));
+    addr += ramstart;
+    pc++;
+    goto WrMainMemAddr; 
+
+  case 7: /* main memory, four-byte address */
+    addr = Mem4(pc);
+    pc += 4;
+    goto WrMainMemAddr;
+
+  case 6: /* main memory, two-byte address */
+    addr = (glui32)Mem2(pc);
+    pc += 2;
+    goto WrMainMemAddr;
+
+  case 5: /* main memory, one-byte address */
+    addr = (glui32)(Mem1(pc));
+    pc++;
+    /* fall through */
+
+  WrMainMemAddr:
+    /* cases 5, 6, 7 all wind up here. */
+    arg->desttype = 1;
+    arg->value = addr;
+    break;
+
+  case 11: /* locals, four-byte address */
+    addr = Mem4(pc);
+    pc += 4;
+    goto WrLocalsAddr;
+
+  case 10: /* locals, two-byte address */
+    addr = (glui32)Mem2(pc);
+    pc += 2;
+    goto WrLocalsAddr; 
+
+  case 9: /* locals, one-byte address */
+    addr = (glui32)(Mem1(pc));
+    pc++;
+    /* fall through */
+
+  WrLocalsAddr:
+    /* cases 9, 10, 11 all wind up here. It's illegal for addr to not
+       be four-byte aligned, but we don't check this explicitly. 
+       A "strict mode" interpreter probably should. It's also illegal
+       for addr to be less than zero or greater than the size of
+       the locals segment. */
+    arg->desttype = 2;
+    /* We don't add localsbase here; the store address for desttype 2
+       is relative to the current locals segment, not an absolute
+       stack position. */
+    arg->value = addr;
+    break;
+
+  case 1:
+  case 2:
+  case 3:
+    fatal_error("Constant addressing mode in store operand.");
+
+  default:
+    fatal_error("Unknown addressing mode in store operand.");
+  }
+}
+
 /* parse_operands():
    Read the list of operands of an instruction, and put the values
    in args. This assumes that the PC is at the beginning of the
@@ -349,6 +816,10 @@ const operandlist_t *lookup_operandlist(glui32 opcode)
 
    This also assumes that args points at an allocated array of 
    MAX_OPERANDS oparg_t structures.
+
+   Every operandlist in this file has its own parser function (see
+   below), which execute_loop() calls instead. This general version
+   handles any other operandlist.
 */
 void parse_operands(oparg_t *args, const operandlist_t *oplist)
 {
@@ -363,10 +834,6 @@ void parse_operands(oparg_t *args, const operandlist_t *oplist)
 
   for (ix=0, curarg=args; ix<numops; ix++, curarg++) {
     int mode;
-    glui32 value;
-    glui32 addr;
-
-    curarg->desttype = 0;
 
     if ((ix & 1) == 0) {
       modeval = Mem1(modeaddr);
@@ -378,217 +845,11 @@ void parse_operands(oparg_t *args, const operandlist_t *oplist)
     }
 
     if (oplist->formlist[ix] == modeform_Load) {
-
-      switch (mode) {
-
-      case 8: /* pop off stack */
-        if (stackptr < valstackbase+4) {
-          fatal_error("Stack underflow in operand.");
-        }
-        stackptr -= 4;
-        value = Stk4(stackptr);
-        break;
-
-      case 0: /* constant zero */
-        value = 0;
-        break;
-
-      case 1: /* one-byte constant */
-        /* Sign-extend from 8 bits to 32 */
-        value = (glsi32)(signed char)(Mem1(pc));
-        pc++;
-        break;
-
-      case 2: /* two-byte constant */
-        /* Sign-extend the first byte from 8 bits to 32; the subsequent
-           byte must not be sign-extended. */
-        value = (glsi32)(signed char)(Mem1(pc));
-        pc++;
-        value = (value << 8) | (glui32)(Mem1(pc));
-        pc++;
-        break;
-
-      case 3: /* four-byte constant */
-        /* Bytes must not be sign-extended. */
-        value = Mem4(pc);
-        pc += 4;
-        break;
-
-      case 15: /* main memory RAM, four-byte address */
-        addr = Mem4(pc);
-        addr += ramstart;
-        pc += 4;
-        goto MainMemAddr; 
-
-      case 14: /* main memory RAM, two-byte address */
-        addr = (glui32)Mem2(pc);
-        addr += ramstart;
-        pc += 2;
-        goto MainMemAddr; 
-
-      case 13: /* main memory RAM, one-byte address */
-        addr = (glui32)(Mem1(pc));
-        addr += ramstart;
-        pc++;
-        goto MainMemAddr; 
-        
-      case 7: /* main memory, four-byte address */
-        addr = Mem4(pc);
-        pc += 4;
-        goto MainMemAddr;
-
-      case 6: /* main memory, two-byte address */
-        addr = (glui32)Mem2(pc);
-        pc += 2;
-        goto MainMemAddr;
-
-      case 5: /* main memory, one-byte address */
-        addr = (glui32)(Mem1(pc));
-        pc++;
-        /* fall through */
-
-      MainMemAddr:
-        /* cases 5, 6, 7, 13, 14, 15 all wind up here. */
-        if (argsize == 4) {
-          value = Mem4(addr);
-        }
-        else if (argsize == 2) {
-          value = Mem2(addr);
-        }
-        else {
-          value = Mem1(addr);
-        }
-        break;
-
-      case 11: /* locals, four-byte address */
-        addr = Mem4(pc);
-        pc += 4;
-        goto LocalsAddr;
-
-      case 10: /* locals, two-byte address */
-        addr = (glui32)Mem2(pc);
-        pc += 2;
-        goto LocalsAddr; 
-
-      case 9: /* locals, one-byte address */
-        addr = (glui32)(Mem1(pc));
-        pc++;
-        /* fall through */
-
-      LocalsAddr:
-        /* cases 9, 10, 11 all wind up here. It's illegal for addr to not
-           be four-byte aligned, but we don't check this explicitly. 
-           A "strict mode" interpreter probably should. It's also illegal
-           for addr to be less than zero or greater than the size of
-           the locals segment. */
-        addr += localsbase;
-        if (argsize == 4) {
-          value = Stk4(addr);
-        }
-        else if (argsize == 2) {
-          value = Stk2(addr);
-        }
-        else {
-          value = Stk1(addr);
-        }
-        break;
-
-      default:
-        value = 0;
-        fatal_error("Unknown addressing mode in load operand.");
-      }
-
-      curarg->value = value;
-
+      curarg->desttype = 0;
+      curarg->value = parse_load_operand(mode, argsize);
     }
-    else {  /* modeform_Store */
-      switch (mode) {
-
-      case 0: /* discard value */
-        curarg->desttype = 0;
-        curarg->value = 0;
-        break;
-
-      case 8: /* push on stack */
-        curarg->desttype = 3;
-        curarg->value = 0;
-        break;
-
-      case 15: /* main memory RAM, four-byte address */
-        addr = Mem4(pc);
-        addr += ramstart;
-        pc += 4;
-        goto WrMainMemAddr; 
-
-      case 14: /* main memory RAM, two-byte address */
-        addr = (glui32)Mem2(pc);
-        addr += ramstart;
-        pc += 2;
-        goto WrMainMemAddr; 
-
-      case 13: /* main memory RAM, one-byte address */
-        addr = (glui32)(Mem1(pc));
-        addr += ramstart;
-        pc++;
-        goto WrMainMemAddr; 
-
-      case 7: /* main memory, four-byte address */
-        addr = Mem4(pc);
-        pc += 4;
-        goto WrMainMemAddr;
-
-      case 6: /* main memory, two-byte address */
-        addr = (glui32)Mem2(pc);
-        pc += 2;
-        goto WrMainMemAddr;
-
-      case 5: /* main memory, one-byte address */
-        addr = (glui32)(Mem1(pc));
-        pc++;
-        /* fall through */
-
-      WrMainMemAddr:
-        /* cases 5, 6, 7 all wind up here. */
-        curarg->desttype = 1;
-        curarg->value = addr;
-        break;
-
-      case 11: /* locals, four-byte address */
-        addr = Mem4(pc);
-        pc += 4;
-        goto WrLocalsAddr;
-
-      case 10: /* locals, two-byte address */
-        addr = (glui32)Mem2(pc);
-        pc += 2;
-        goto WrLocalsAddr; 
-
-      case 9: /* locals, one-byte address */
-        addr = (glui32)(Mem1(pc));
-        pc++;
-        /* fall through */
-
-      WrLocalsAddr:
-        /* cases 9, 10, 11 all wind up here. It's illegal for addr to not
-           be four-byte aligned, but we don't check this explicitly. 
-           A "strict mode" interpreter probably should. It's also illegal
-           for addr to be less than zero or greater than the size of
-           the locals segment. */
-        curarg->desttype = 2;
-        /* We don't add localsbase here; the store address for desttype 2
-           is relative to the current locals segment, not an absolute
-           stack position. */
-        curarg->value = addr;
-        break;
-
-      case 1:
-      case 2:
-      case 3:
-        fatal_error("Constant addressing mode in store operand.");
-
-      default:
-        fatal_error("Unknown addressing mode in store operand.");
-      }
+    else {
+      parse_store_operand(curarg, mode);
     }
   }
 }
@@ -609,6 +870,12 @@ void store_operand(glui32 desttype, glui32 destaddr, glui32 storeval)
     MemW4(destaddr, storeval);
     return;
 
+  case 4: /* main memory, address already verified. (Only decoded
+             operands have this; pop_callstub() rejects it.) */
+    WatchW(destaddr);
+    Write4(memmap+destaddr, storeval);
+    return;
+
   case 2: /* locals. */
     destaddr += localsbase;
     StkW4(destaddr, storeval);
@@ -641,6 +908,11 @@ void store_operand_s(glui32 desttype, glui32 destaddr, glui32 storeval)
     MemW2(destaddr, storeval);
     return;
 
+  case 4: /* main memory, address already verified. */
+    WatchW(destaddr);
+    Write2(memmap+destaddr, storeval);
+    return;
+
   case 2: /* locals. */
     destaddr += localsbase;
     StkW2(destaddr, storeval);
@@ -673,6 +945,11 @@ void store_operand_b(glui32 desttype, glui32 destaddr, glui32 storeval)
     MemW1(destaddr, storeval);
     return;
 
+  case 4: /* main memory, address already verified. */
+    WatchW(destaddr);
+    Write1(memmap+destaddr, storeval);
+    return;
+
   case 2: /* locals. */
     destaddr += localsbase;
     StkW1(destaddr, storeval);
@@ -691,3 +968,435 @@ void store_operand_b(glui32 desttype, glui32 destaddr, glui32 storeval)
 
   }
 }
+
+#ifdef DECODE_CACHE
+
+/* The decode cache is a direct-mapped table, indexed by the low bits
+   of the instruction address. Each entry records one ROM instruction,
+   with its operand addressing modes boiled down to the dkind_* values
+   in glulxe.h. */
+
+decodedinst_t *decodecache = NULL;
+
+static int fixed_address_ok(glui32 addr, glui32 len, int write);
+
+/* init_decode_cache():
+   Allocate the decode cache and mark every entry unused. If the
+   allocation fails, we just run without it.
+*/
+void init_decode_cache()
+{
+  int ix;
+
+  if (!decodecache) {
+    decodecache = (decodedinst_t *)glulx_malloc(DECODE_CACHE_SIZE 
+      * sizeof(decodedinst_t));
+    if (!decodecache)
+      return;
+  }
+
+  for (ix=0; ix<DECODE_CACHE_SIZE; ix++)
+    decodecache[ix].addr = 0xFFFFFFFF;
+}
+
+/* final_decode_cache():
+   Throw away the decode cache when the VM shuts down.
+*/
+void final_decode_cache()
+{
+  if (decodecache) {
+    glulx_free(decodecache);
+    decodecache = NULL;
+  }
+}
+
+/* fixed_address_ok():
+   Check whether len bytes at a fixed main-memory address are always in
+   range, so that a decoded operand can skip the check on every access.
+   The memory map can grow and shrink, but never below origendmem, and
+   ramstart never changes. A write must also be to RAM.
+*/
+static int fixed_address_ok(glui32 addr, glui32 len, int write)
+{
+  if (addr >= origendmem || origendmem - addr < len)
+    return FALSE;
+  if (write && addr < ramstart)
+    return FALSE;
+  return TRUE;
+}
+
+/* decode_one():
+   Decode the instruction at addr into the given cache entry. This
+   reads the opcode and the operand modes and immediate values, but
+   does not load any operand values (so it has no effect on the stack
+   or the PC.)
+   Returns TRUE if the entry is filled in. If the instruction is not
+   entirely in ROM, it cannot be cached; the entry is marked unused
+   and this returns FALSE. This also returns FALSE (rather than
+   raising an error) for an unknown opcode or addressing mode. The
+   caller then falls back to parse_operands(), which will report the
+   problem if the instruction is ever executed.
+*/
+static int decode_one(decodedinst_t *dec, glui32 addr)
+{
+  int ix;
+  glui32 instaddr = addr;
+  glui32 opcode;
+  const operandlist_t *oplist;
+  glui32 modeaddr;
+  int modeval = 0;
+  int numops;
+
+  dec->addr = 0xFFFFFFFF;
+
+  /* Fetch the opcode number, exactly as execute_loop() does. */
+  opcode = Mem1(addr);
+  addr++;
+  if (opcode & 0x80) {
+    if (opcode & 0x40) {
+      opcode &= 0x3F;
+      opcode = (opcode << 8) | Mem1(addr);
+      addr++;
+      opcode = (opcode << 8) | Mem1(addr);
+      addr++;
+      opcode = (opcode << 8) | Mem1(addr);
+      addr++;
+    }
+    else {
+      opcode &= 0x7F;
+      opcode = (opcode << 8) | Mem1(addr);
+      addr++;
+    }
+  }
+
+  if (opcode < 0x80)
+    oplist = fast_operandlist[opcode];
+  else
+    oplist = lookup_operandlist(opcode);
+
+  if (!oplist)
+    return FALSE;
+
+  numops = oplist->num_ops;
+  modeaddr = addr;
+  addr += (numops+1) / 2;
+
+  for (ix=0; ix<numops; ix++) {
+    int mode;
+    int kind;
+    glui32 value;
+
+    if ((ix & 1) == 0) {
+      modeval = Mem1(modeaddr);
+      mode = (modeval & 0x0F);
+    }
+    else {
+      mode = ((modeval >> 4) & 0x0F);
+      modeaddr++;
+    }
+
+    /* First, read the immediate data, if any. The sign-extension rules
+       are the same as in parse_operands(). */
+    switch (mode) {
+    case 0:
+    case 8:
+      value = 0;
+      break;
+    case 1:
+      value = (glsi32)(signed char)(Mem1(addr));
+      addr++;
+      break;
+    case 2:
+      value = (glsi32)(signed char)(Mem1(addr));
+      addr++;
+      value = (value << 8) | (glui32)(Mem1(addr));
+      addr++;
+      break;
+    case 5:
+    case 9:
+    case 13:
+      value = (glui32)(Mem1(addr));
+      addr++;
+      break;
+    case 6:
+    case 10:
+    case 14:
+      value = (glui32)Mem2(addr);
+      addr += 2;
+      break;
+    case 3:
+    case 7:
+    case 11:
+    case 15:
+      value = Mem4(addr);
+      addr += 4;
+      break;
+    default:
+      value = 0;
+      break;
+    }
+
+    if (mode >= 13 && mode <= 15)
+      value += ramstart;
+
+    /* Then work out what kind of operand it is. */
+    if (oplist->formlist[ix] == modeform_Load) {
+      switch (mode) {
+      case 0:
+      case 1:
+      case 2:
+      case 3:
+        kind = dkind_LoadConst;
+        break;
+      case 5:
+      case 6:
+      case 7:
+      case 13:
+      case 14:
+      case 15:
+        if (fixed_address_ok(value, oplist->arg_size, FALSE))
+          kind = dkind_LoadMemVerified;
+        else
+          kind = dkind_LoadMem;
+        break;
+      case 9:
+      case 10:
+      case 11:
+        kind = dkind_LoadLocal;
+        break;
+      case 8:
+        kind = dkind_LoadStack;
+        break;
+      default:
+        return FALSE;
+      }
+    }
+    else {
+      switch (mode) {
+      case 0:
+        kind = dkind_Store+0;
+        break;
+      case 5:
+      case 6:
+      case 7:
+      case 13:
+      case 14:
+      case 15:
+        /* A store may be four bytes wide, whatever the arg size. */
+        if (fixed_address_ok(value, 4, TRUE))
+          kind = dkind_Store+4;
+        else
+          kind = dkind_Store+1;
+        break;
+      case 9:
+      case 10:
+      case 11:
+        kind = dkind_Store+2;
+        break;
+      case 8:
+        kind = dkind_Store+3;
+        break;
+      default:
+        return FALSE;
+      }
+    }
+
+    dec->kinds[ix] = kind;
+    dec->values[ix] = value;
+  }
+
+  /* Only cache the instruction if all of it lies in ROM. */
+  if (addr > ramstart)
+    return FALSE;
+
+  dec->nextaddr = addr;
+  dec->opcode = opcode;
+  dec->oplist = oplist;
+  dec->addr = instaddr;
+  return TRUE;
+}
+
+#ifdef FUSED_OPCODES
+
+/* fuse_instruction():
+   Check whether a decoded instruction and the one after it form one of
+   the pairs that execute_loop() runs as a single superinstruction:
+
+   - @aload, @aloads, or @aloadb to the stack, followed by @jz or @jnz
+     on the stack (or @jeq or @jne of the stack against a constant or
+     local.) The loaded value never touches the stack.
+   - @copy to a local, followed by @add of that local and a constant
+     or local.
+
+   The branch offset must be a constant; the @add may store anywhere.
+   If the pair matches, the second instruction's operands are stored
+   in the fused fields of dec.
+*/
+static void fuse_instruction(decodedinst_t *dec)
+{
+  decodedinst_t next;
+  int ix;
+  int fusion;
+
+  dec->fusion = fuse_None;
+
+  switch (dec->opcode) {
+  case op_aload:
+  case op_aloads:
+  case op_aloadb:
+    if (dec->kinds[2] != dkind_Store+3)
+      return;
+    break;
+  case op_copy:
+    if (dec->kinds[1] != dkind_Store+2)
+      return;
+    break;
+  default:
+    return;
+  }
+
+  if (!decode_one(&next, dec->nextaddr))
+    return;
+
+  if (dec->opcode == op_copy) {
+    if (next.opcode != op_add)
+      return;
+    if (next.kinds[0] != dkind_LoadLocal 
+      || next.values[0] != dec->values[1])
+      return;
+    if (next.kinds[1] != dkind_LoadConst 
+      && next.kinds[1] != dkind_LoadLocal)
+      return;
+    fusion = fuse_CopyAdd;
+  }
+  else {
+    switch (next.opcode) {
+    case op_jz:
+    case op_jnz:
+      if (next.kinds[0] != dkind_LoadStack 
+        || next.kinds[1] != dkind_LoadConst)
+        return;
+      break;
+    case op_jeq:
+    case op_jne:
+      if (next.kinds[0] != dkind_LoadStack 
+        || next.kinds[2] != dkind_LoadConst)
+        return;
+      if (next.kinds[1] != dkind_LoadConst 
+        && next.kinds[1] != dkind_LoadLocal)
+        return;
+      break;
+    default:
+      return;
+    }
+    fusion = fuse_LoadBranch;
+  }
+
+  dec->fusedop = next.opcode;
+  dec->fusednext = next.nextaddr;
+  for (ix=0; ix<next.oplist->num_ops; ix++) {
+    dec->fusedkinds[ix] = next.kinds[ix];
+    dec->fusedvalues[ix] = next.values[ix];
+  }
+  dec->fusion = fusion;
+}
+
+#endif /* FUSED_OPCODES */
+
+/* decode_instruction():
+   Decode the instruction at addr into the given cache entry, as
+   described in decode_one(). If FUSED_OPCODES is on, this also checks
+   whether the instruction can be fused with the following one.
+*/
+int decode_instruction(decodedinst_t *dec, glui32 addr)
+{
+  if (!decode_one(dec, addr))
+    return FALSE;
+#ifdef FUSED_OPCODES
+  fuse_instruction(dec);
+#endif /* FUSED_OPCODES */
+  return TRUE;
+}
+
+/* parse_decoded_operands():
+   Load the operand values of a cached instruction into args, as
+   parse_operands() would. The caller has already moved the PC to the
+   next instruction.
+*/
+void parse_decoded_operands(oparg_t *args, const decodedinst_t *dec)
+{
+  int ix;
+  oparg_t *curarg;
+  int numops = dec->oplist->num_ops;
+  int argsize = dec->oplist->arg_size;
+
+  for (ix=0, curarg=args; ix<numops; ix++, curarg++) {
+    glui32 value = dec->values[ix];
+    glui32 addr;
+
+    curarg->desttype = 0;
+
+    switch (dec->kinds[ix]) {
+
+    case dkind_LoadConst:
+      break;
+
+    case dkind_LoadMem:
+      addr = value;
+      if (argsize == 4) {
+        value = Mem4(addr);
+      }
+      else if (argsize == 2) {
+        value = Mem2(addr);
+      }
+      else {
+        value = Mem1(addr);
+      }
+      break;
+
+    case dkind_LoadMemVerified:
+      if (argsize == 4) {
+        value = Read4(memmap+value);
+      }
+      else if (argsize == 2) {
+        value = Read2(memmap+value);
+      }
+      else {
+        value = Read1(memmap+value);
+      }
+      break;
+
+    case dkind_LoadLocal:
+      addr = value + localsbase;
+      if (argsize == 4) {
+        value = Stk4(addr);
+      }
+      else if (argsize == 2) {
+        value = Stk2(addr);
+      }
+      else {
+        value = Stk1(addr);
+      }
+      break;
+
+    case dkind_LoadStack:
+      if (stackptr < valstackbase+4) {
+        fatal_error("Stack underflow in operand.");
+      }
+      stackptr -= 4;
+      value = Stk4(stackptr);
+      break;
+
+    default:
+      /* A store operand; the kind gives us the desttype. (The value is
+         the address, which is zero for discard and push.) */
+      curarg->desttype = dec->kinds[ix] - dkind_Store;
+      break;
+    }
+
+    curarg->value = value;
+  }
+}
+
+#endif /* DECODE_CACHE */
+
@@ -92,6 +92,376 @@ void glulx_free(void *ptr)
   free(ptr);
 }
 
+#ifdef GUARD_MEMORY_ACCESS
+
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+/* The guarded main-memory block. We reserve enough address space that
+   any 32-bit Glulx address (plus a few bytes, for a four-byte access)
+   lands inside the reservation, and make only the live part accessible.
+   The block is placed so that its end falls exactly on a page boundary;
+   any access at or past endmem then hits an inaccessible page. */
+static unsigned char *guardbase = NULL;
+static size_t guardsize = 0;
+static size_t guardpage = 0;
+static size_t guardlive = 0;
+static struct sigaction guardoldsegv;
+static struct sigaction guardoldbus;
+static char *guardaltstack = NULL;
+
+/* A fault in the reservation jumps back to guard_fault_jmp, which
+   glk_main() sets up (and then sets guard_fault_armed), with the Glulx
+   address in guard_fault_addr. The error is reported from there; the
+   signal handler itself can't safely call into Glk. */
+sigjmp_buf guard_fault_jmp;
+int guard_fault_armed = FALSE;
+glui32 guard_fault_addr = 0;
+
+/* The offset within the reservation where a block of len bytes starts. */
+#define GUARD_OFFSET(len)  ((guardpage - ((len) & (guardpage-1))) & (guardpage-1))
+
+/* Catch a fault in the reservation and jump out to report it as a
+   Glulx error. Any other fault is not ours (nor is one that comes
+   before glk_main() is ready for it); we restore the previous handler
+   and return, so that the faulting access repeats and does whatever it
+   would have. */
+static void guard_handler(int sig, siginfo_t *info, void *context)
+{
+  unsigned char *ptr = (unsigned char *)info->si_addr;
+
+  if (guard_fault_armed
+    && guardbase && ptr >= guardbase && ptr < guardbase+guardsize) {
+    guard_fault_addr = (glui32)(ptr - memmap);
+    siglongjmp(guard_fault_jmp, 1);
+  }
+
+  sigaction(SIGSEGV, &guardoldsegv, NULL);
+  sigaction(SIGBUS, &guardoldbus, NULL);
+}
+
+/* Make the first live bytes of the reservation accessible (rounded up
+   to a page), and the rest inaccessible. The contents of the dead part
+   are discarded, so that memory is returned to the OS. */
+static int guard_set_live(size_t live)
+{
+  live = (live + guardpage-1) & ~(guardpage-1);
+  if (live > guardlive) {
+    if (mprotect(guardbase, live, PROT_READ|PROT_WRITE))
+      return FALSE;
+  }
+  else if (live < guardlive) {
+    if (mprotect(guardbase+live, guardlive-live, PROT_NONE))
+      return FALSE;
+    madvise(guardbase+live, guardlive-live, MADV_DONTNEED);
+  }
+  guardlive = live;
+  return TRUE;
+}
+
+/* Allocate the main-memory block. There is only ever one of these. */
+unsigned char *glulx_guarded_malloc(glui32 len)
+{
+  struct sigaction act;
+  void *res;
+
+  if (guardbase)
+    return NULL;
+
+  guardpage = sysconf(_SC_PAGESIZE);
+  guardsize = guardpage + ((size_t)1 << 32) + guardpage;
+  res = mmap(NULL, guardsize, PROT_NONE,
+    MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE, -1, 0);
+  if (res == MAP_FAILED)
+    return NULL;
+  guardbase = (unsigned char *)res;
+  guardlive = 0;
+
+  if (!guard_set_live(GUARD_OFFSET(len) + len)) {
+    munmap(guardbase, guardsize);
+    guardbase = NULL;
+    return NULL;
+  }
+
+  /* Run the handler on its own stack, unless the library has already
+     set one up. */
+  if (!guardaltstack) {
+    stack_t oldss;
+    if (sigaltstack(NULL, &oldss) == 0 && (oldss.ss_flags & SS_DISABLE)) {
+      stack_t ss;
+      guardaltstack = malloc(SIGSTKSZ);
+      if (guardaltstack) {
+        ss.ss_sp = guardaltstack;
+        ss.ss_size = SIGSTKSZ;
+        ss.ss_flags = 0;
+        if (sigaltstack(&ss, NULL)) {
+          free(guardaltstack);
+          guardaltstack = NULL;
+        }
+      }
+    }
+  }
+
+  memset(&act, 0, sizeof(act));
+  act.sa_sigaction = guard_handler;
+  act.sa_flags = SA_SIGINFO | SA_ONSTACK;
+  sigemptyset(&act.sa_mask);
+  sigaction(SIGSEGV, &act, &guardoldsegv);
+  sigaction(SIGBUS, &act, &guardoldbus);
+
+  return guardbase + GUARD_OFFSET(len);
+}
+
+/* Resize the main-memory block. Since the end of the block must stay
+   on a page boundary, the contents may have to shift within the
+   reservation. As with glulx_realloc(), a failure leaves the block
+   unchanged. */
+unsigned char *glulx_guarded_realloc(unsigned char *ptr, glui32 oldlen,
+  glui32 len)
+{
+  unsigned char *newptr;
+
+  if (!guardbase || ptr != guardbase + GUARD_OFFSET(oldlen))
+    return NULL;
+
+  newptr = guardbase + GUARD_OFFSET(len);
+  if (len > oldlen) {
+    if (!guard_set_live(GUARD_OFFSET(len) + len))
+      return NULL;
+    memmove(newptr, ptr, oldlen);
+  }
+  else {
+    memmove(newptr, ptr, len);
+    /* The block has already moved, so we can't fail now. (If mprotect
+       fails, which it shouldn't, the dead pages stay accessible.) */
+    guard_set_live(GUARD_OFFSET(len) + len);
+  }
+  return newptr;
+}
+
+/* Deallocate the main-memory block, and stop catching faults. */
+void glulx_guarded_free(unsigned char *ptr)
+{
+  if (!guardbase)
+    return;
+  sigaction(SIGSEGV, &guardoldsegv, NULL);
+  sigaction(SIGBUS, &guardoldbus, NULL);
+  munmap(guardbase, guardsize);
+  guardbase = NULL;
+  guardlive = 0;
+}
+
+#endif /* GUARD_MEMORY_ACCESS */
+
+#ifdef RESERVE_MEMORY
+
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#ifdef MAP_GAME_FILE
+#include <fcntl.h>
+#endif /* MAP_GAME_FILE */
+
+/* The main-memory block sits at the start of a large anonymous private
+   mapping (the reservation), made with MAP_NORESERVE. The OS commits
+   and zeroes each page when it is first touched, so the block can grow
+   in place at no cost. We keep everything in the reservation past the
+   end of the block zero. If the OS won't give us a reservation that
+   large, we reserve just what's needed; growing the block then means
+   moving it to a new reservation.
+
+   With MAP_GAME_FILE, glulx_map_game() maps whole pages of the game
+   file over the start of the block, copy-on-write. A file mapping has
+   to start at a page boundary in the file, but the Glulx data in a
+   Blorb file can start anywhere. So the block begins mapskew bytes into
+   the reservation, where mapskew is gamefile_start's offset within its
+   page; the first page then lines up with the file. (Those extra bytes
+   are part of the Blorb file, and nobody looks at them.) mapok is true
+   if the last attempt to map the file succeeded. */
+static size_t respage = 0;
+static size_t resspan = 0;
+static glui32 mapskew = 0;
+#ifdef MAP_GAME_FILE
+static int mapok = FALSE;
+#endif /* MAP_GAME_FILE */
+
+/* How much address space to ask for. On a 64-bit system, this is
+   enough for any Glulx memory size. */
+#ifdef __LP64__
+#define RESERVE_SPAN ((size_t)1 << 32)
+#else /* __LP64__ */
+#define RESERVE_SPAN ((size_t)1 << 28)
+#endif /* __LP64__ */
+
+#define RES_ROUND(len)  (((size_t)mapskew + (len) + respage-1) & ~(respage-1))
+
+/* Reserve space for a block of at least len bytes, and set resspan to
+   the size of the reservation. */
+static unsigned char *reserve_block(glui32 len)
+{
+  void *res;
+
+  resspan = RES_ROUND(RESERVE_SPAN);
+  if (resspan < RES_ROUND(len))
+    resspan = RES_ROUND(len);
+  res = mmap(NULL, resspan, PROT_READ|PROT_WRITE,
+    MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE, -1, 0);
+  if (res == MAP_FAILED) {
+    resspan = RES_ROUND(len);
+    res = mmap(NULL, resspan, PROT_READ|PROT_WRITE,
+      MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE, -1, 0);
+    if (res == MAP_FAILED)
+      return NULL;
+  }
+  return (unsigned char *)res + mapskew;
+}
+
+/* Allocate the main-memory block. There is only ever one of these. Its
+   contents are zero. */
+unsigned char *glulx_reserved_malloc(glui32 len)
+{
+  if (!respage)
+    respage = sysconf(_SC_PAGESIZE);
+#ifdef MAP_GAME_FILE
+  mapskew = (gamefile_pathname ? (gamefile_start & (respage-1)) : 0);
+  mapok = FALSE;
+#endif /* MAP_GAME_FILE */
+  return reserve_block(len);
+}
+
+/* Resize the main-memory block. Usually this just changes the size:
+   shrinking zeroes the end of the last page and gives the pages past it
+   back to the OS. If growing the block overflows the reservation, we
+   move it to a new one. (With MAP_GAME_FILE, we map the ROM into the
+   new one again, so a write to mapped ROM, which is illegal anyway, is
+   undone.) As with glulx_realloc(), a failure leaves the block
+   unchanged. Any new space past oldlen is zero. */
+unsigned char *glulx_reserved_realloc(unsigned char *ptr, glui32 oldlen,
+  glui32 len)
+{
+  unsigned char *base = ptr - mapskew;
+  unsigned char *newptr;
+  size_t oldspan, pageend;
+  glui32 rom = 0;
+
+  if (len <= oldlen) {
+    pageend = RES_ROUND(len) - mapskew;
+    if (pageend > oldlen)
+      pageend = oldlen;
+    memset(ptr+len, 0, pageend-len);
+    if (RES_ROUND(oldlen) > RES_ROUND(len)) {
+      /* Replacing the pages is the portable way to both discard them
+         and get zero pages back. If it fails, we zero them the slow
+         way. */
+      if (mmap(base+RES_ROUND(len), RES_ROUND(oldlen)-RES_ROUND(len),
+          PROT_READ|PROT_WRITE,
+          MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE|MAP_FIXED, -1, 0)
+        == MAP_FAILED)
+        memset(ptr+pageend, 0, oldlen-pageend);
+    }
+    return ptr;
+  }
+
+  if (RES_ROUND(len) <= resspan)
+    return ptr;
+
+  oldspan = resspan;
+  newptr = reserve_block(len);
+  if (!newptr) {
+    resspan = oldspan;
+    return NULL;
+  }
+#ifdef MAP_GAME_FILE
+  if (mapok)
+    rom = glulx_map_game(newptr, ramstart);
+#endif /* MAP_GAME_FILE */
+  memcpy(newptr+rom, ptr+rom, oldlen-rom);
+  munmap(base, oldspan);
+  return newptr;
+}
+
+/* Deallocate the main-memory block. */
+void glulx_reserved_free(unsigned char *ptr)
+{
+  munmap(ptr-mapskew, resspan);
+  resspan = 0;
+#ifdef MAP_GAME_FILE
+  mapok = FALSE;
+#endif /* MAP_GAME_FILE */
+}
+
+/* Allocate a block whose pages are committed only when they're first
+   touched. This is for the stack. Its contents are zero. */
+unsigned char *glulx_lazy_malloc(glui32 len)
+{
+  void *res;
+
+  res = mmap(NULL, len, PROT_READ|PROT_WRITE,
+    MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE, -1, 0);
+  if (res == MAP_FAILED)
+    return NULL;
+  return (unsigned char *)res;
+}
+
+/* Deallocate a block from glulx_lazy_malloc(). */
+void glulx_lazy_free(unsigned char *ptr, glui32 len)
+{
+  munmap(ptr, len);
+}
+
+#ifdef MAP_GAME_FILE
+
+/* Map the game file over the main-memory block, covering as many whole
+   pages as fit below the address limit. This discards whatever was
+   there. Returns the number of bytes of memory mapped (counting from
+   address zero); the caller must read in the rest. If the file can't
+   be mapped, this returns zero and leaves the block's contents
+   undefined. */
+glui32 glulx_map_game(unsigned char *ptr, glui32 limit)
+{
+  unsigned char *base = ptr - mapskew;
+  size_t maplen;
+  int fd;
+  void *res;
+
+  mapok = FALSE;
+  if (!gamefile_pathname)
+    return 0;
+  if (limit > gamefile_len)
+    limit = gamefile_len;
+  maplen = ((size_t)mapskew + limit) & ~(respage-1);
+  if (maplen < mapskew + 0x100)
+    return 0;
+
+  fd = open(gamefile_pathname, O_RDONLY);
+  if (fd < 0)
+    return 0;
+  res = mmap(base, maplen, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_FIXED,
+    fd, gamefile_start - mapskew);
+  close(fd);
+
+  /* Make sure that this is the same file the Glk stream has open. */
+  if (res != MAP_FAILED && Read4(ptr+32) != checksum) {
+    res = MAP_FAILED;
+  }
+  if (res == MAP_FAILED) {
+    /* A failed MAP_FIXED may have unmapped the old pages, so put
+       fresh ones back. */
+    mmap(base, maplen, PROT_READ|PROT_WRITE,
+      MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE|MAP_FIXED, -1, 0);
+    return 0;
+  }
+
+  mapok = TRUE;
+  return maplen - mapskew;
+}
+
+#endif /* MAP_GAME_FILE */
+
+#endif /* RESERVE_MEMORY */
+
 #ifdef UNIX_RAND_ARC4
 
 /* Use arc4random() as the native RNG. It doesn't need to be seeded. */
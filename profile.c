@@ -135,7 +135,7 @@ typedef struct frame_struct {
 static function_t **functions = NULL;
 static frame_t *current_frame = NULL;
 
-/* This counter is globally visible, because the profile_tick() macro
+/* This counter is globally visible, because the profile_ticks() macro
    increments it. */
 glui32 profile_opcount = 0;
 
@@ -105,6 +105,41 @@ int init_serial()
   return TRUE;
 }
 
+/* reset_ram_from_cache():
+   Copy the original contents of RAM back into main memory, from
+   ramstart to origendmem (the zeroed space past endgamefile included),
+   skipping over the protected range. Returns FALSE if the original RAM
+   is not cached; the caller must then read it from the game file.
+*/
+int reset_ram_from_cache()
+{
+#ifdef SERIALIZE_CACHE_RAM
+  glui32 pos, end;
+
+  if (!ramcache)
+    return FALSE;
+
+  pos = ramstart;
+  while (pos < origendmem) {
+    end = origendmem;
+    if (protectstart < protectend) {
+      if (pos >= protectstart && pos < protectend) {
+        pos = protectend;
+        continue;
+      }
+      if (pos < protectstart && protectstart < end)
+        end = protectstart;
+    }
+    memcpy(memmap+pos, ramcache+(pos-ramstart), end-pos);
+    pos = end;
+  }
+
+  return TRUE;
+#else /* SERIALIZE_CACHE_RAM */
+  return FALSE;
+#endif /* SERIALIZE_CACHE_RAM */
+}
+
 /* final_serial():
    Clean up memory when the VM shuts down.
 */
@@ -448,6 +483,10 @@ glui32 perform_save(strid_t str)
   if (str == 0)
     return 1;
 
+  /* str might be the current output stream, so it must be up to
+     date. */
+  stream_flush();
+
   dest.ismem = FALSE;
   dest.size = 0;
   dest.pos = 0;
@@ -596,6 +635,10 @@ glui32 perform_restore(strid_t str, int fromshell)
   if (str == 0)
     return 1;
 
+  /* str might be the current output stream, so it must be up to
+     date. */
+  stream_flush();
+
   dest.ismem = FALSE;
   dest.size = 0;
   dest.pos = 0;
@@ -13,25 +13,86 @@ static glui32 iosys_rock;
 #define iosys_Filter (1)
 #define iosys_Glk (2)
 
-#define CACHEBITS (4)
+/* The number of bits of a compressed string that the decoder looks up
+   at once. This may be anywhere from 4 to 12. Every table in the cache
+   has 1<<CACHEBITS entries, so a wider table decodes more of a string
+   per step, but takes more memory. */
+#define CACHEBITS (8)
 #define CACHESIZE (1<<CACHEBITS) 
-#define CACHEMASK (15)
+#define CACHEMASK (CACHESIZE-1)
 
+/* The most characters that one cache entry can print. */
+#define CACHERUN (4)
+
+/* A cache entry is either a node of the string table, or (type 0x80)
+   a run of single-character nodes whose codes all fit in CACHEBITS
+   bits. The run type is ours; it never appears in a game file. A
+   non-leaf entry refers to the table below it by its index in
+   cachearena. Entries are eight bytes. */
 typedef struct cacheblock_struct {
-  int depth; /* 1 to 4 */
-  int type;
+  unsigned char depth; /* 1 to CACHEBITS */
+  unsigned char type;
+  unsigned char count; /* for a run: the number of characters */
+  unsigned char firstdepth; /* for a run: the first character's depth */
   union {
-    struct cacheblock_struct *branches;
+    glui32 branches;
     unsigned char ch;
+    unsigned char chars[CACHERUN];
     glui32 uch;
     glui32 addr;
   } u;
 } cacheblock_t;
 
 /* The current string-decoding tables, broken out into a fast and
-   easy-to-use form. */
+   easy-to-use form. If the root of the string table is a non-leaf
+   node, all the tables are allocated together in cachearena, one
+   after another, with the root table first. */
 static int tablecache_valid = FALSE;
 static cacheblock_t tablecache;
+static cacheblock_t *cachearena = NULL;
+static glui32 cachearena_used = 0;
+
+/* The range of memory that the cache was built from: the table's
+   header and every node we read. (Nothing else is copied into the
+   cache; leaves that refer to other memory are read when they're
+   printed.) If any of this is in RAM, the game might change it, so that
+   part of the range is watched (see WatchW() in glulxe.h). A write there
+   sets tablecache_stale, and the cache is rebuilt before it's next
+   used. */
+static glui32 tablelo = 0, tablehi = 0;
+static int tablecache_stale = FALSE;
+static glui32 measurevisits = 0;
+
+/* The result of measurecache() for a tree that can't be cached. */
+#define MEASURE_FAILED (0xFFFFFFFF)
+
+/* The number of entries in the decoded-string cache, and how many of
+   them a given address can use. Both must be powers of two. */
+#define STRINGCACHE_SIZE (256)
+#define STRINGCACHE_WAYS (4)
+/* The longest string (in characters) that we keep in the cache. */
+#define STRINGCACHE_MAXLEN (1024)
+
+/* An entry in the decoded-string cache. This holds the complete output
+   of a compressed string in ROM which contains nothing but characters,
+   so that it can be printed with one Glk call. A string with any other
+   kind of node (or too long, or running into RAM) gets an entry with
+   len -1, so that we don't try it again. */
+typedef struct stringcache_struct {
+  glui32 addr; /* 0 if the entry is unused */
+  glui32 stamp; /* when the entry was last used */
+  int len;
+  int uni; /* buf holds glui32s rather than chars */
+  glui32 bufsize; /* allocated size of buf, in bytes */
+  void *buf;
+} stringcache_t;
+
+/* The decoded-string cache. Each address maps to a set of
+   STRINGCACHE_WAYS entries, and a miss replaces the least recently used
+   one. The cache is only used while tablecache_valid is set, and is
+   cleared when the table changes. */
+static stringcache_t *stringcache = NULL;
+static glui32 stringcache_stamp = 0;
 
 static void stream_setup_unichar(void);
 
@@ -39,13 +100,37 @@ static void nopio_char_han(unsigned char ch);
 static void filio_char_han(unsigned char ch);
 static void nopio_unichar_han(glui32 ch);
 static void filio_unichar_han(glui32 ch);
+static void glkio_char_han(unsigned char ch);
+static void glkio_unichar_han(glui32 ch);
 static void glkio_unichar_nouni_han(glui32 val);
 static void (*glkio_unichar_han_ptr)(glui32 val) = NULL;
 
-static void dropcache(cacheblock_t *cablist);
+/* The output buffer for the Glk iosys. Characters printed through Glk
+   collect here, and are passed to the current Glk stream in one call
+   when stream_flush() is called. That has to happen before anything
+   else might print to (or change) the current stream -- any Glk call,
+   an iosys change, an error message -- and whenever the buffer fills.
+   The characters are kept in outbuf until one beyond Latin-1 turns up;
+   then they're all moved to outbuf_u, and outbuf_uni is set. */
+#define OUTBUF_SIZE (512)
+static unsigned char outbuf[OUTBUF_SIZE];
+static glui32 outbuf_u[OUTBUF_SIZE];
+static int outbuf_len = 0;
+static int outbuf_uni = FALSE;
+
+static void buildtablecache(void);
+static void droptablecache(void);
+static void note_table_range(glui32 addr, glui32 len);
+static glui32 measurecache(glui32 nodeaddr, int depth, int treedepth,
+  int strict);
 static void buildcache(cacheblock_t *cablist, glui32 nodeaddr, int depth,
-  int mask, int recdepth);
+  int mask);
+static void buildruns(void);
 static void dumpcache(cacheblock_t *cablist, int count, int indent);
+static stringcache_t *find_stringcache(glui32 addr);
+static int decode_stringcache(stringcache_t *ent);
+static void put_stringcache(stringcache_t *ent);
+static void drop_stringcache(void);
 
 void stream_get_iosys(glui32 *mode, glui32 *rock)
 {
@@ -71,6 +156,8 @@ static void stream_setup_unichar()
 
 void stream_set_iosys(glui32 mode, glui32 rock)
 {
+  stream_flush();
+
   switch (mode) {
   default:
     mode = 0;
@@ -88,8 +175,8 @@ void stream_set_iosys(glui32 mode, glui32 rock)
     if (!glkio_unichar_han_ptr)
       stream_setup_unichar();
     rock = 0;
-    stream_char_handler = glk_put_char;
-    stream_unichar_handler = glkio_unichar_han_ptr;
+    stream_char_handler = glkio_char_han;
+    stream_unichar_handler = glkio_unichar_han;
     break;
   }
 
@@ -118,6 +205,35 @@ static void filio_unichar_han(glui32 val)
   enter_function(iosys_rock, 1, &val);
 }
 
+static void glkio_char_han(unsigned char ch)
+{
+  if (outbuf_len >= OUTBUF_SIZE)
+    stream_flush();
+  if (!outbuf_uni)
+    outbuf[outbuf_len++] = ch;
+  else
+    outbuf_u[outbuf_len++] = ch;
+}
+
+static void glkio_unichar_han(glui32 val)
+{
+  int ix;
+
+  if (val <= 0xFF) {
+    glkio_char_han(val);
+    return;
+  }
+
+  if (outbuf_len >= OUTBUF_SIZE)
+    stream_flush();
+  if (!outbuf_uni) {
+    for (ix=0; ix<outbuf_len; ix++)
+      outbuf_u[ix] = outbuf[ix];
+    outbuf_uni = TRUE;
+  }
+  outbuf_u[outbuf_len++] = val;
+}
+
 static void glkio_unichar_nouni_han(glui32 val)
 {
   /* Only used if the Glk library has no Unicode functions */
@@ -126,6 +242,35 @@ static void glkio_unichar_nouni_han(glui32 val)
   glk_put_char(val);
 }
 
+/* stream_flush():
+   Send any buffered Glk output to the current Glk stream.
+*/
+void stream_flush()
+{
+  int ix;
+
+  if (outbuf_len == 0)
+    return;
+
+  if (!outbuf_uni) {
+    glk_put_buffer((char *)outbuf, outbuf_len);
+  }
+#ifdef GLK_MODULE_UNICODE
+  else if (glkio_unichar_han_ptr == glk_put_char_uni) {
+    glk_put_buffer_uni(outbuf_u, outbuf_len);
+  }
+#endif /* GLK_MODULE_UNICODE */
+  else {
+    /* The library can't print anything beyond Latin-1. */
+    for (ix=0; ix<outbuf_len; ix++)
+      outbuf[ix] = (outbuf_u[ix] > 0xFF) ? '?' : outbuf_u[ix];
+    glk_put_buffer((char *)outbuf, outbuf_len);
+  }
+
+  outbuf_len = 0;
+  outbuf_uni = FALSE;
+}
+
 /* stream_num():
    Write a signed integer to the current output stream.
 */
@@ -164,7 +309,7 @@ void stream_num(glsi32 val, int inmiddle, int charnum)
     ix -= charnum;
     while (ix > 0) {
       ix--;
-      glk_put_char(buf[ix]);
+      glkio_char_han(buf[ix]);
     }
     break;
 
@@ -226,19 +371,31 @@ void stream_string(glui32 addr, int inmiddle, int bitnum)
     }
 
     if (type == 0xE1) {
-      if (tablecache_valid) {
-        int bits, numbits;
-        int readahead;
+      stringcache_t *ent;
+      if (tablecache_stale) {
+        droptablecache();
+        buildtablecache();
+      }
+      if (inmiddle == 0 && iosys_mode == iosys_Glk && tablecache_valid
+        && (ent = find_stringcache(addr-1)) != NULL) {
+        /* The whole string is in the decoded-string cache. */
+        put_stringcache(ent);
+      }
+      else if (tablecache_valid) {
+        glui32 bits;
+        int numbits;
+        glui32 nextaddr;
         glui32 tmpaddr;
         cacheblock_t *cablist;
         int done = 0;
 
-        /* bitnum is already set right */
+        /* bitnum is already set right. We keep the next numbits bits
+           of the string in bits; they end at the start of nextaddr. */
         bits = Mem1(addr); 
         if (bitnum)
           bits >>= bitnum;
         numbits = (8 - bitnum);
-        readahead = FALSE;
+        nextaddr = addr+1;
 
         if (tablecache.type != 0) {
           /* This is a bit of a cheat. If the top-level block is not
@@ -248,38 +405,30 @@ void stream_string(glui32 addr, int inmiddle, int bitnum)
           done = 1;
         }
 
-        cablist = tablecache.u.branches;
+        cablist = cachearena;
         while (!done) {
           cacheblock_t *cab;
 
-          if (numbits < CACHEBITS) {
-            /* readahead is certainly false */
-            int newbyte = Mem1(addr+1);
-            bits |= (newbyte << numbits);
+          /* Don't read past the end of memory; a string that gets
+             there without ending is an error anyway. */
+          while (numbits < CACHEBITS && nextaddr < endmem) {
+            bits |= ((glui32)Mem1(nextaddr) << numbits);
+            nextaddr++;
             numbits += 8;
-            readahead = TRUE;
           }
 
           cab = &(cablist[bits & CACHEMASK]);
+          if (cab->depth > numbits)
+            fatal_error("Compressed string runs past the end of memory.");
           numbits -= cab->depth;
           bits >>= cab->depth;
           bitnum += cab->depth;
-          if (bitnum >= 8) {
-            addr += 1;
-            bitnum -= 8;
-            if (readahead) {
-              readahead = FALSE;
-            }
-            else {
-              int newbyte = Mem1(addr);
-              bits |= (newbyte << numbits);
-              numbits += 8;
-            }
-          }
+          addr += (bitnum >> 3);
+          bitnum &= 7;
 
           switch (cab->type) {
           case 0x00: /* non-leaf node */
-            cablist = cab->u.branches;
+            cablist = cachearena + cab->u.branches;
             break;
           case 0x01: /* string terminator */
             done = 1;
@@ -287,7 +436,7 @@ void stream_string(glui32 addr, int inmiddle, int bitnum)
           case 0x02: /* single character */
             switch (iosys_mode) {
             case iosys_Glk:
-              glk_put_char(cab->u.ch);
+              glkio_char_han(cab->u.ch);
               break;
             case iosys_Filter: 
               ival = cab->u.ch & 0xFF;
@@ -300,12 +449,41 @@ void stream_string(glui32 addr, int inmiddle, int bitnum)
               enter_function(iosys_rock, 1, &ival);
               return;
             }
-            cablist = tablecache.u.branches;
+            cablist = cachearena;
+            break;
+          case 0x80: /* run of characters */
+            switch (iosys_mode) {
+            case iosys_Glk:
+              {
+                int ix;
+                for (ix=0; ix<cab->count; ix++)
+                  glkio_char_han(cab->u.chars[ix]);
+              }
+              break;
+            case iosys_Filter: 
+              /* The filter gets one character at a time, so back up
+                 to the end of the first one. */
+              bitnum -= (cab->depth - cab->firstdepth);
+              while (bitnum < 0) {
+                addr -= 1;
+                bitnum += 8;
+              }
+              ival = cab->u.chars[0];
+              if (!substring) {
+                push_callstub(0x11, 0);
+                substring = TRUE;
+              }
+              pc = addr;
+              push_callstub(0x10, bitnum);
+              enter_function(iosys_rock, 1, &ival);
+              return;
+            }
+            cablist = cachearena;
             break;
           case 0x04: /* single Unicode character */
             switch (iosys_mode) {
             case iosys_Glk:
-              glkio_unichar_han_ptr(cab->u.uch);
+              glkio_unichar_han(cab->u.uch);
               break;
             case iosys_Filter: 
               ival = cab->u.uch;
@@ -318,14 +496,14 @@ void stream_string(glui32 addr, int inmiddle, int bitnum)
               enter_function(iosys_rock, 1, &ival);
               return;
             }
-            cablist = tablecache.u.branches;
+            cablist = cachearena;
             break;
           case 0x03: /* C string */
             switch (iosys_mode) {
             case iosys_Glk:
               for (tmpaddr=cab->u.addr; (ch=Mem1(tmpaddr)) != '\0'; tmpaddr++) 
-                glk_put_char(ch);
-              cablist = tablecache.u.branches; 
+                glkio_char_han(ch);
+              cablist = cachearena; 
               break;
             case iosys_Filter:
               if (!substring) {
@@ -339,7 +517,7 @@ void stream_string(glui32 addr, int inmiddle, int bitnum)
               done = 2;
               break;
             default:
-              cablist = tablecache.u.branches; 
+              cablist = cachearena; 
               break;
             }
             break;
@@ -347,8 +525,8 @@ void stream_string(glui32 addr, int inmiddle, int bitnum)
             switch (iosys_mode) {
             case iosys_Glk:
               for (tmpaddr=cab->u.addr; (ival=Mem4(tmpaddr)) != 0; tmpaddr+=4) 
-                glkio_unichar_han_ptr(ival);
-              cablist = tablecache.u.branches; 
+                glkio_unichar_han(ival);
+              cablist = cachearena; 
               break;
             case iosys_Filter:
               if (!substring) {
@@ -362,7 +540,7 @@ void stream_string(glui32 addr, int inmiddle, int bitnum)
               done = 2;
               break;
             default:
-              cablist = tablecache.u.branches; 
+              cablist = cachearena; 
               break;
             }
             break;
@@ -459,7 +637,7 @@ void stream_string(glui32 addr, int inmiddle, int bitnum)
             ch = Mem1(node);
             switch (iosys_mode) {
             case iosys_Glk:
-              glk_put_char(ch);
+              glkio_char_han(ch);
               break;
             case iosys_Filter: 
               ival = ch & 0xFF;
@@ -478,7 +656,7 @@ void stream_string(glui32 addr, int inmiddle, int bitnum)
             ival = Mem4(node);
             switch (iosys_mode) {
             case iosys_Glk:
-              glkio_unichar_han_ptr(ival);
+              glkio_unichar_han(ival);
               break;
             case iosys_Filter: 
               if (!substring) {
@@ -496,7 +674,7 @@ void stream_string(glui32 addr, int inmiddle, int bitnum)
             switch (iosys_mode) {
             case iosys_Glk:
               for (; (ch=Mem1(node)) != '\0'; node++) 
-                glk_put_char(ch);
+                glkio_char_han(ch);
               node = Mem4(stringtable+8);
               break;
             case iosys_Filter:
@@ -519,7 +697,7 @@ void stream_string(glui32 addr, int inmiddle, int bitnum)
             switch (iosys_mode) {
             case iosys_Glk:
               for (; (ival=Mem4(node)) != 0; node+=4) 
-                glkio_unichar_han_ptr(ival);
+                glkio_unichar_han(ival);
               node = Mem4(stringtable+8);
               break;
             case iosys_Filter:
@@ -599,7 +777,7 @@ void stream_string(glui32 addr, int inmiddle, int bitnum)
           addr++;
           if (ch == '\0')
             break;
-          glk_put_char(ch);
+          glkio_char_han(ch);
         }
         break;
       case iosys_Filter:
@@ -627,7 +805,7 @@ void stream_string(glui32 addr, int inmiddle, int bitnum)
           addr+=4;
           if (ival == 0)
             break;
-          glkio_unichar_han_ptr(ival);
+          glkio_unichar_han(ival);
         }
         break;
       case iosys_Filter:
@@ -686,59 +864,230 @@ void stream_set_table(glui32 addr)
   if (stringtable == addr)
     return;
 
-  /* Drop cache. */
+  droptablecache();
+
+  stringtable = addr;
+
+  if (stringtable)
+    buildtablecache();
+}
+
+/* buildtablecache():
+   Build the decoding cache for the current table. A table entirely in
+   ROM can't change, so its cache lasts until the table is replaced. If
+   any of it is in RAM, that part is watched, and the cache is rebuilt
+   when it changes.
+
+   A malformed table whose header is in ROM is a fatal error here, as
+   it always was. A table in RAM may just be half-written, so we decode
+   it uncached instead (which complains only if a string actually runs
+   into the problem). The watch is still set, so that once the game
+   fixes the table, the cache comes back.
+*/
+static void buildtablecache()
+{
+  glui32 rootaddr;
+  glui32 tablecount;
+  int strict;
+
+  tablecache_stale = FALSE;
+  tablelo = stringtable;
+  tablehi = stringtable;
+  note_table_range(stringtable, 12);
+
+  strict = (stringtable < ramstart && ramstart - stringtable >= 12);
+  if (strict || (stringtable < endmem && endmem - stringtable >= 12)) {
+    rootaddr = Mem4(stringtable+8);
+    measurevisits = 0;
+    tablecount = measurecache(rootaddr, CACHEBITS, 0, strict);
+  }
+  else {
+    tablecount = MEASURE_FAILED;
+  }
+
+  if (tablehi > ramstart) {
+    watchstart = ((tablelo > ramstart) ? tablelo : ramstart) - 3;
+    watchlen = tablehi - watchstart;
+  }
+
+  if (tablecount == MEASURE_FAILED)
+    return;
+
+  /* Allocate all the tables at once. */
+  if (tablecount) {
+    if (tablecount > 0xFFFFFFFF / (sizeof(cacheblock_t) * CACHESIZE))
+      cachearena = NULL;
+    else
+      cachearena = (cacheblock_t *)glulx_malloc(tablecount
+        * sizeof(cacheblock_t) * CACHESIZE);
+    if (!cachearena) {
+      /* We'll have to decode without the cache. */
+      droptablecache();
+      return;
+    }
+  }
+  cachearena_used = 0;
+
+  buildcache(&tablecache, rootaddr, CACHEBITS, 0);
+  if (tablecache.type == 0)
+    buildruns();
+  /* dumpcache(&tablecache, 1, 0); */
+  tablecache_valid = TRUE;
+}
+
+/* droptablecache():
+   Throw away the decoding cache, and everything that depends on it.
+*/
+static void droptablecache()
+{
   if (tablecache_valid) {
-    if (tablecache.type == 0)
-      dropcache(tablecache.u.branches);
-    tablecache.u.branches = NULL;
+    tablecache.u.branches = 0;
     tablecache_valid = FALSE;
+    drop_stringcache();
   }
 
-  stringtable = addr;
+  if (cachearena) {
+    glulx_free(cachearena);
+    cachearena = NULL;
+    cachearena_used = 0;
+  }
 
-  if (stringtable) {
-    /* Build cache. We can only do this if the table is entirely in ROM. */
-    glui32 tablelen = Mem4(stringtable);
-    glui32 rootaddr = Mem4(stringtable+8);
-    int cache_stringtable = (stringtable+tablelen <= ramstart);
-    /* cache_stringtable = TRUE; ...for testing only */
-    /* cache_stringtable = FALSE; ...for testing only */
-    if (cache_stringtable) {
-      buildcache(&tablecache, rootaddr, CACHEBITS, 0, 0);
-      /* dumpcache(&tablecache, 1, 0); */
-      tablecache_valid = TRUE;
-    }
+  tablecache_stale = FALSE;
+  tablelo = 0;
+  tablehi = 0;
+  watchstart = 0;
+  watchlen = 0;
+}
+
+/* stream_table_changed():
+   Called when memory that the decoding cache was built from may have
+   changed. The cache is rebuilt the next time a string needs it. We
+   stop watching until then, so that further writes cost nothing.
+*/
+void stream_table_changed()
+{
+  tablecache_stale = TRUE;
+  watchlen = 0;
+}
+
+/* note_table_range():
+   Extend the range of memory that the cache is built from.
+*/
+static void note_table_range(glui32 addr, glui32 len)
+{
+  if (addr < tablelo)
+    tablelo = addr;
+  if (addr > 0xFFFFFFFF - len)
+    tablehi = 0xFFFFFFFF;
+  else if (addr+len > tablehi)
+    tablehi = addr+len;
+}
+
+/* measurecache():
+   Count the tables that the cache needs for the tree below nodeaddr,
+   which is depth bits into its table and treedepth bits below the root
+   of the tree. This is also where we check the depth of the tree (and
+   so catch loops in it), so that buildcache() doesn't have to, and
+   where we note the memory that each node occupies.
+
+   If strict is set, a bad tree is a fatal error. Otherwise this returns
+   MEASURE_FAILED for a tree that's too deep, too big, or runs outside
+   memory.
+*/
+static glui32 measurecache(glui32 nodeaddr, int depth, int treedepth,
+  int strict)
+{
+  glui32 count = 0;
+  glui32 subcount;
+  glui32 len;
+  int type;
+
+  /* This gets up to 24 in large games, so I think 48 is a generous
+     maximum. If it's not, we might need a command-line parameter. */
+  if (treedepth >= 48) {
+    if (strict)
+      fatal_error("Apparent infinite recursion in buildcache");
+    return MEASURE_FAILED;
+  }
+
+  if (!strict) {
+    /* A tree with shared branches can be exponentially large. A real
+       one has no more nodes than memory has bytes. */
+    measurevisits++;
+    if (nodeaddr >= endmem || measurevisits > endmem)
+      return MEASURE_FAILED;
+  }
+
+  type = Mem1(nodeaddr);
+  switch (type) {
+  case 0x00:
+    len = 9;
+    break;
+  case 0x02:
+    len = 2;
+    break;
+  case 0x04:
+  case 0x08:
+  case 0x09:
+    len = 5;
+    break;
+  default:
+    /* The contents of other leaves are read when they're printed. */
+    len = 1;
+    break;
+  }
+  if (!strict && endmem - nodeaddr < len)
+    return MEASURE_FAILED;
+  note_table_range(nodeaddr, len);
+
+  if (type != 0)
+    return 0;
+
+  if (depth == CACHEBITS) {
+    count = 1;
+    depth = 0;
   }
+  subcount = measurecache(Mem4(nodeaddr+1), depth+1, treedepth+1, strict);
+  if (subcount == MEASURE_FAILED)
+    return MEASURE_FAILED;
+  count += subcount;
+  subcount = measurecache(Mem4(nodeaddr+5), depth+1, treedepth+1, strict);
+  if (subcount == MEASURE_FAILED)
+    return MEASURE_FAILED;
+  count += subcount;
+  return count;
 }
 
+/* buildcache():
+   Fill in the entries of cablist for the tree below nodeaddr, which is
+   depth bits into the table. mask holds the bits of the code so far.
+   New tables are taken from cachearena, which measurecache() has made
+   big enough.
+*/
 static void buildcache(cacheblock_t *cablist, glui32 nodeaddr, int depth,
-  int mask, int recdepth)
+  int mask)
 {
   int ix, type;
 
-  /* This gets up to 24 in large games, so I think 48 is a generous
-     maximum. If it's not, we might need a command-line parameter. */
-  if (recdepth >= 48)
-    fatal_error("Apparent infinite recursion in buildcache");
-  
   type = Mem1(nodeaddr);
 
   if (type == 0 && depth == CACHEBITS) {
-    cacheblock_t *list, *cab;
-    list = (cacheblock_t *)glulx_malloc(sizeof(cacheblock_t) * CACHESIZE);
-    buildcache(list, nodeaddr, 0, 0, recdepth+1);
+    cacheblock_t *cab;
+    glui32 index = cachearena_used;
+    cachearena_used += CACHESIZE;
+    buildcache(cachearena+index, nodeaddr, 0, 0);
     cab = &(cablist[mask]);
     cab->type = 0;
     cab->depth = CACHEBITS;
-    cab->u.branches = list;
+    cab->u.branches = index;
     return;
   }
 
   if (type == 0) {
     glui32 leftaddr  = Mem4(nodeaddr+1);
     glui32 rightaddr = Mem4(nodeaddr+5);
-    buildcache(cablist, leftaddr, depth+1, mask, recdepth+1);
-    buildcache(cablist, rightaddr, depth+1, (mask | (1 << depth)), recdepth+1);
+    buildcache(cablist, leftaddr, depth+1, mask);
+    buildcache(cablist, rightaddr, depth+1, (mask | (1 << depth)));
     return;
   }
 
@@ -769,6 +1118,54 @@ static void buildcache(cacheblock_t *cablist, glui32 nodeaddr, int depth,
   }
 }
 
+/* buildruns():
+   Turn each single-character entry in the cache into a run, if the
+   bits left over after its code begin another single-character code.
+   A run goes on for as many codes as fit in CACHEBITS bits, up to
+   CACHERUN characters. Decoding continues at the root after any
+   character, so the following codes are looked up in the root table.
+   The root table can be converted while we look in it; a run there
+   still starts with the character that was there before.
+*/
+static void buildruns()
+{
+  glui32 pos;
+  int ix, used, nextdepth;
+  cacheblock_t *cab, *next;
+
+  for (pos=0; pos<cachearena_used; pos++) {
+    cab = &(cachearena[pos]);
+    if (cab->type != 0x02)
+      continue;
+
+    ix = pos & CACHEMASK;
+    cab->count = 1;
+    cab->firstdepth = cab->depth;
+    used = cab->depth;
+    while (cab->count < CACHERUN) {
+      /* The next code starts with the top CACHEBITS-used bits of ix.
+         The root entry for those is only certain if its code is no
+         longer than that. */
+      next = &(cachearena[ix >> used]);
+      if (next->type == 0x02)
+        nextdepth = next->depth;
+      else if (next->type == 0x80)
+        nextdepth = next->firstdepth;
+      else
+        break;
+      if (used + nextdepth > CACHEBITS)
+        break;
+      cab->u.chars[cab->count] = next->u.chars[0];
+      cab->count++;
+      used += nextdepth;
+    }
+    if (cab->count > 1) {
+      cab->type = 0x80;
+      cab->depth = used;
+    }
+  }
+}
+
 #if 0
 #include <stdio.h>
 static void dumpcache(cacheblock_t *cablist, int count, int indent)
@@ -783,7 +1180,7 @@ static void dumpcache(cacheblock_t *cablist, int count, int indent)
     switch (cab->type) {
     case 0:
       printf("...\n");
-      dumpcache(cab->u.branches, CACHESIZE, indent+1);
+      dumpcache(cachearena + cab->u.branches, CACHESIZE, indent+1);
       break;
     case 1:
       printf("<EOS>\n");
@@ -795,6 +1192,10 @@ static void dumpcache(cacheblock_t *cablist, int count, int indent)
       else
         printf(" '%c'\n", cab->u.ch);
       break;
+    case 0x80:
+      printf("run of %d: '%.*s'\n", cab->count, cab->count,
+        (char *)cab->u.chars);
+      break;
     default:
       printf("type %02X, address %06lX\n", cab->type, cab->u.addr);
       break;
@@ -803,17 +1204,235 @@ static void dumpcache(cacheblock_t *cablist, int count, int indent)
 }
 #endif /* 0 */
 
-static void dropcache(cacheblock_t *cablist)
+/* find_stringcache():
+   Look up the compressed string at addr (the address of its E1 byte)
+   in the decoded-string cache, decoding it if it isn't there. Returns
+   NULL if the string can't be cached. This must only be called when
+   tablecache_valid is set.
+*/
+static stringcache_t *find_stringcache(glui32 addr)
 {
   int ix;
-  for (ix=0; ix<CACHESIZE; ix++) {
-    cacheblock_t *cab = &(cablist[ix]);
-    if (cab->type == 0) {
-      dropcache(cab->u.branches);
-      cab->u.branches = NULL;
+  stringcache_t *set, *ent;
+
+  if (addr >= ramstart)
+    return NULL;
+
+  if (!stringcache) {
+    stringcache = (stringcache_t *)glulx_malloc(STRINGCACHE_SIZE
+      * sizeof(stringcache_t));
+    if (!stringcache)
+      return NULL;
+    for (ix=0; ix<STRINGCACHE_SIZE; ix++) {
+      ent = &(stringcache[ix]);
+      ent->addr = 0;
+      ent->stamp = 0;
+      ent->len = -1;
+      ent->uni = FALSE;
+      ent->bufsize = 0;
+      ent->buf = NULL;
     }
   }
-  glulx_free(cablist);
+
+  stringcache_stamp++;
+  if (stringcache_stamp == 0) {
+    /* The clock has wrapped around; forget the old ages. */
+    for (ix=0; ix<STRINGCACHE_SIZE; ix++)
+      stringcache[ix].stamp = 0;
+    stringcache_stamp = 1;
+  }
+
+  set = &(stringcache[((addr ^ (addr >> 11)) * STRINGCACHE_WAYS)
+    & (STRINGCACHE_SIZE-1)]);
+  ent = set;
+  for (ix=0; ix<STRINGCACHE_WAYS; ix++) {
+    if (set[ix].addr == addr) {
+      set[ix].stamp = stringcache_stamp;
+      if (set[ix].len < 0)
+        return NULL;
+      return &(set[ix]);
+    }
+    if (set[ix].stamp < ent->stamp)
+      ent = &(set[ix]);
+  }
+
+  ent->addr = addr;
+  ent->stamp = stringcache_stamp;
+  if (!decode_stringcache(ent)) {
+    ent->len = -1;
+    return NULL;
+  }
+  return ent;
+}
+
+/* decode_stringcache():
+   Decode the string at ent->addr into ent's buffer, using the string-
+   decoding cache. Returns FALSE if the string can't be cached.
+*/
+static int decode_stringcache(stringcache_t *ent)
+{
+  static glui32 tempbuf[STRINGCACHE_MAXLEN];
+  glui32 addr, nextaddr, bits, size;
+  int bitnum, numbits;
+  int ix, len, uni, done;
+  cacheblock_t *cablist, *cab;
+
+  len = 0;
+  uni = FALSE;
+
+  if (tablecache.type == 0) {
+    /* This is the same bit-reader as in stream_string(), except that
+       it stops at the start of RAM. */
+    addr = ent->addr+1;
+    bits = Mem1(addr);
+    numbits = 8;
+    bitnum = 0;
+    nextaddr = addr+1;
+    cablist = cachearena;
+    done = FALSE;
+    while (!done) {
+      while (numbits < CACHEBITS && nextaddr < ramstart) {
+        bits |= ((glui32)Mem1(nextaddr) << numbits);
+        nextaddr++;
+        numbits += 8;
+      }
+
+      cab = &(cablist[bits & CACHEMASK]);
+      if (cab->depth > numbits)
+        return FALSE;
+      numbits -= cab->depth;
+      bits >>= cab->depth;
+      bitnum += cab->depth;
+      addr += (bitnum >> 3);
+      bitnum &= 7;
+
+      switch (cab->type) {
+      case 0x00: /* non-leaf node */
+        cablist = cachearena + cab->u.branches;
+        break;
+      case 0x01: /* string terminator */
+        done = TRUE;
+        break;
+      case 0x02: /* single character */
+        if (len >= STRINGCACHE_MAXLEN)
+          return FALSE;
+        tempbuf[len++] = cab->u.ch;
+        cablist = cachearena;
+        break;
+      case 0x80: /* run of characters */
+        if (len + cab->count > STRINGCACHE_MAXLEN)
+          return FALSE;
+        for (ix=0; ix<cab->count; ix++)
+          tempbuf[len++] = cab->u.chars[ix];
+        cablist = cachearena;
+        break;
+      case 0x04: /* single Unicode character */
+        if (len >= STRINGCACHE_MAXLEN)
+          return FALSE;
+        tempbuf[len++] = cab->u.uch;
+        if (cab->u.uch > 0xFF)
+          uni = TRUE;
+        cablist = cachearena;
+        break;
+      default:
+        /* Anything else has to be printed the slow way. */
+        return FALSE;
+      }
+    }
+  }
+
+  size = (uni ? len*sizeof(glui32) : len);
+  if (size > ent->bufsize) {
+    if (ent->buf)
+      glulx_free(ent->buf);
+    ent->bufsize = 0;
+    ent->buf = glulx_malloc(size);
+    if (!ent->buf)
+      return FALSE;
+    ent->bufsize = size;
+  }
+
+  if (uni) {
+    glui32 *ubuf = (glui32 *)ent->buf;
+    for (ix=0; ix<len; ix++)
+      ubuf[ix] = tempbuf[ix];
+  }
+  else {
+    char *cbuf = (char *)ent->buf;
+    for (ix=0; ix<len; ix++)
+      cbuf[ix] = tempbuf[ix];
+  }
+  ent->len = len;
+  ent->uni = uni;
+  return TRUE;
+}
+
+/* put_stringcache():
+   Print a cached string through the Glk output buffer. If it won't fit
+   in the buffer, we flush the buffer and print the string directly.
+*/
+static void put_stringcache(stringcache_t *ent)
+{
+  int ix;
+
+  if (outbuf_len + ent->len <= OUTBUF_SIZE) {
+    if (!ent->uni) {
+      unsigned char *cbuf = (unsigned char *)ent->buf;
+      if (!outbuf_uni) {
+        for (ix=0; ix<ent->len; ix++)
+          outbuf[outbuf_len+ix] = cbuf[ix];
+      }
+      else {
+        for (ix=0; ix<ent->len; ix++)
+          outbuf_u[outbuf_len+ix] = cbuf[ix];
+      }
+      outbuf_len += ent->len;
+    }
+    else {
+      glui32 *ubuf = (glui32 *)ent->buf;
+      for (ix=0; ix<ent->len; ix++)
+        glkio_unichar_han(ubuf[ix]);
+    }
+    return;
+  }
+
+  stream_flush();
+
+  if (!ent->uni) {
+    glk_put_buffer((char *)ent->buf, ent->len);
+    return;
+  }
+
+#ifdef GLK_MODULE_UNICODE
+  if (glkio_unichar_han_ptr == glk_put_char_uni) {
+    glk_put_buffer_uni((glui32 *)ent->buf, ent->len);
+    return;
+  }
+#endif /* GLK_MODULE_UNICODE */
+
+  for (ix=0; ix<ent->len; ix++)
+    glkio_unichar_han_ptr(((glui32 *)ent->buf)[ix]);
+}
+
+/* drop_stringcache():
+   Empty the decoded-string cache, freeing its buffers.
+*/
+static void drop_stringcache()
+{
+  int ix;
+  stringcache_t *ent;
+
+  if (!stringcache)
+    return;
+
+  for (ix=0; ix<STRINGCACHE_SIZE; ix++) {
+    ent = &(stringcache[ix]);
+    if (ent->buf)
+      glulx_free(ent->buf);
+  }
+  glulx_free(stringcache);
+  stringcache = NULL;
+  stringcache_stamp = 0;
 }
 
 /* This misbehaves if a Glk function has more than one S argument. */
@@ -17,10 +17,25 @@
 #include "gi_debug.h" 
 #endif /* VM_DEBUGGER */
 
+#ifdef FORK_SERVER
+#include <stdio.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#endif /* FORK_SERVER */
+
 static void glkunix_game_select(glui32 selector, glui32 arg0, glui32 arg1, glui32 arg2);
 static void glkunix_game_start(void);
 static void glkunix_game_autorestore(void);
 
+#ifdef FORK_SERVER
+static char *pref_forkserver = NULL;
+static void glkunix_game_fork(void);
+#endif /* FORK_SERVER */
+
 /* The only command-line arguments are the filename and the number of
    undo states. And the profiling switch, if that's compiled in. The
    only *three* command-line arguments are...
@@ -35,6 +50,10 @@ glkunix_argumentlist_t glkunix_arguments[] = {
 
   { "--undo", glkunix_arg_ValueFollows, "Number of undo states to store." },
   { "--rngseed", glkunix_arg_ValueFollows, "Fix initial RNG if nonzero." },
+  { "--tickinterval", glkunix_arg_ValueFollows, "Number of instructions between glk_tick() calls (default: 1)." },
+#ifdef CACHE_STATS
+  { "--cachestats", glkunix_arg_NoValue, "Display cache hit counts at exit." },
+#endif /* CACHE_STATS */
 
 #if GLKUNIX_AUTOSAVE_FEATURES
   { "--autosave", glkunix_arg_NoValue, "Autosave every turn." },
@@ -44,6 +63,10 @@ glkunix_argumentlist_t glkunix_arguments[] = {
   { "--autoskiparrange", glkunix_arg_NoValue, "Don't autosave on arrange events." },
 #endif /* GLKUNIX_AUTOSAVE_FEATURES */
 
+#ifdef FORK_SERVER
+  { "--forkserver", glkunix_arg_ValueFollows, "Set up the game, then start a fresh game for each connection to this Unix socket." },
+#endif /* FORK_SERVER */
+
 #if VM_PROFILING
   { "--profile", glkunix_arg_ValueFollows, "Generate profiling information to a file." },
   { "--profcalls", glkunix_arg_NoValue, "Include what-called-what details in profiling. (Slow!)" },
@@ -108,6 +131,27 @@ int glkunix_startup_code(glkunix_startup_t *data)
       continue;
     }
 
+    if (!strcmp(data->argv[ix], "--tickinterval")) {
+      ix++;
+      if (ix<data->argc) {
+        char *endptr = NULL;
+        int val = strtol(data->argv[ix], &endptr, 10);
+        if (*endptr || val < 1) {
+          init_err = "--tickinterval must be a positive number.";
+          return TRUE;
+        }
+        tick_interval = val;
+      }
+      continue;
+    }
+
+#ifdef CACHE_STATS
+    if (!strcmp(data->argv[ix], "--cachestats")) {
+      pref_cache_stats = TRUE;
+      continue;
+    }
+#endif /* CACHE_STATS */
+
 #if GLKUNIX_AUTOSAVE_FEATURES
     if (!strcmp(data->argv[ix], "--autosave")) {
       pref_autosave = TRUE;
@@ -137,6 +181,16 @@ int glkunix_startup_code(glkunix_startup_t *data)
     }
 #endif /* GLKUNIX_AUTOSAVE_FEATURES */
 
+#ifdef FORK_SERVER
+    if (!strcmp(data->argv[ix], "--forkserver")) {
+      ix++;
+      if (ix<data->argc) {
+        pref_forkserver = data->argv[ix];
+      }
+      continue;
+    }
+#endif /* FORK_SERVER */
+
 #if VM_PROFILING
     if (!strcmp(data->argv[ix], "--profile")) {
       ix++;
@@ -203,6 +257,7 @@ int glkunix_startup_code(glkunix_startup_t *data)
     init_err2 = filename;
     return TRUE;
   }
+  gamefile_pathname = filename;
 
 #if GLKUNIX_AUTOSAVE_FEATURES
   if (pref_autosave || pref_autorestore) {
@@ -214,6 +269,11 @@ int glkunix_startup_code(glkunix_startup_t *data)
   }
 #endif /* GLKUNIX_AUTOSAVE_FEATURES */
 
+#ifdef FORK_SERVER
+  if (pref_forkserver)
+    set_library_fork_hook(glkunix_game_fork);
+#endif /* FORK_SERVER */
+
 #if VM_DEBUGGER
   if (gameinfofilename) {
     strid_t debugstr = glkunix_stream_open_pathname_gen(gameinfofilename, FALSE, FALSE, 1);
@@ -323,3 +383,128 @@ static void glkunix_game_autorestore()
 }
 
 #endif /* GLKUNIX_AUTOSAVE_FEATURES */
+
+#ifdef FORK_SERVER
+
+/* glkunix_game_fork():
+   This is the library_fork_hook, which is called once the VM is set up.
+   It listens on the --forkserver socket and never returns in the
+   server process. For each connection, it forks a child; the child
+   takes the connection as its stdin, stdout, and stderr, and returns
+   to run the game.
+*/
+static void glkunix_game_fork()
+{
+  int sock, conn;
+  pid_t pid;
+  struct sockaddr_un addr;
+  struct stat st;
+  strid_t newfile;
+  unsigned char buf[36];
+
+  /* Every child reopens the game file by name, so we need one. */
+  if (!gamefile_pathname) {
+    fatal_error("The fork server requires the game file's pathname.");
+    return;
+  }
+
+  if (strlen(pref_forkserver) >= sizeof(addr.sun_path)) {
+    fatal_error_2("The fork server socket name is too long.", 
+      pref_forkserver);
+    return;
+  }
+
+  /* Clear away a socket left by an earlier server, but nothing else;
+     a mistyped path shouldn't destroy a file. */
+  if (lstat(pref_forkserver, &st) == 0) {
+    if (!S_ISSOCK(st.st_mode)) {
+      fatal_error_2("The fork server path exists and is not a socket.", 
+        pref_forkserver);
+      return;
+    }
+    unlink(pref_forkserver);
+  }
+
+  sock = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (sock < 0) {
+    fatal_error("Unable to create the fork server socket.");
+    return;
+  }
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, pref_forkserver);
+  if (bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0
+    || listen(sock, 16) < 0) {
+    fatal_error_2("Unable to listen on the fork server socket.", 
+      pref_forkserver);
+    return;
+  }
+
+  /* We never wait for the children, so let them be reaped as they
+     exit. */
+  signal(SIGCHLD, SIG_IGN);
+  fflush(stdout);
+  fflush(stderr);
+
+  while (1) {
+    conn = accept(sock, NULL, NULL);
+    if (conn < 0) {
+      if (errno == EINTR || errno == ECONNABORTED)
+        continue;
+      fatal_error("Unable to accept a fork server connection.");
+      return;
+    }
+    pid = fork();
+    if (pid == 0)
+      break;
+    /* In the server. If the fork failed, the connection is simply
+       dropped. */
+    close(conn);
+  }
+
+  /* In the child. */
+  close(sock);
+  signal(SIGCHLD, SIG_DFL);
+  dup2(conn, 0);
+  dup2(conn, 1);
+  dup2(conn, 2);
+  if (conn > 2)
+    close(conn);
+
+  /* The game file stream's position is shared with the server and
+     every other child, so open our own stream. (If the game is in a
+     Blorb file, the resource map has to be rebuilt on the new stream.) */
+  newfile = glkunix_stream_open_pathname(gamefile_pathname, FALSE, 1);
+  if (!newfile) {
+    fatal_error_2("Unable to reopen the game file in the fork server.",
+      gamefile_pathname);
+    return;
+  }
+
+  /* The file may have been replaced since the server loaded it. Make
+     sure it's still the same game, since we keep the server's ROM. */
+  glk_stream_set_position(newfile, gamefile_start, seekmode_Start);
+  if (glk_get_buffer_stream(newfile, (char *)buf, 36) != 36
+    || !(buf[0] == 'G' && buf[1] == 'l' && buf[2] == 'u' && buf[3] == 'l')
+    || Read4(buf+32) != checksum) {
+    glk_stream_close(newfile, NULL);
+    fatal_error_2("The game file has changed since the fork server started.",
+      gamefile_pathname);
+    return;
+  }
+
+  /* Close the server's stream, so that we don't hold its shared
+     descriptor for the whole session. */
+  glk_stream_close(gamefile, NULL);
+  gamefile = newfile;
+  if (gamefile_start)
+    giblorb_set_resource_map(gamefile);
+
+  /* The RNG was seeded before the fork, so every child would replay
+     the same sequence. Reseed it, unless the user gave a fixed seed
+     (in which case every session is meant to get the same one). */
+  if (init_rng_seed == 0)
+    glulx_setrandom(0);
+}
+
+#endif /* FORK_SERVER */
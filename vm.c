@@ -3,6 +3,7 @@
     http://eblong.com/zarf/glulx/index.html
 */
 
+#include <string.h>
 #include "glk.h"
 #include "glulxe.h"
 
@@ -29,6 +30,7 @@ glui32 valstackbase;
 glui32 localsbase;
 glui32 endmem;
 glui32 protectstart, protectend;
+glui32 watchstart = 0, watchlen = 0;
 
 /* This is not needed for VM operation, but it may be needed for
    autosave/autorestore. */
@@ -37,6 +39,15 @@ glui32 prevpc;
 void (*stream_char_handler)(unsigned char ch);
 void (*stream_unichar_handler)(glui32 ch);
 
+/* Whether the ROM has been loaded into memmap. Once it has, a restart
+   only needs to reset RAM. */
+static int romloaded = FALSE;
+
+static unsigned char *alloc_memmap(glui32 len);
+static unsigned char *realloc_memmap(unsigned char *ptr, glui32 oldlen,
+  glui32 len);
+static void free_memmap(unsigned char *ptr, glui32 len);
+
 /* setup_vm():
    Read in the game file and build the machine, allocating all the memory
    necessary.
@@ -98,20 +109,37 @@ void setup_vm()
   /* Allocate main memory and the stack. This is where memory allocation
      errors are most likely to occur. */
   endmem = origendmem;
-  memmap = (unsigned char *)glulx_malloc(origendmem);
+  memmap = alloc_memmap(origendmem);
   if (!memmap) {
     fatal_error("Unable to allocate Glulx memory space.");
   }
+#ifdef RESERVE_MEMORY
+  stack = glulx_lazy_malloc(stacksize);
+#else /* RESERVE_MEMORY */
   stack = (unsigned char *)glulx_malloc(stacksize);
+#endif /* RESERVE_MEMORY */
   if (!stack) {
-    glulx_free(memmap);
+    free_memmap(memmap, origendmem);
     memmap = NULL;
     fatal_error("Unable to allocate Glulx stack space.");
   }
   stringtable = 0;
+  romloaded = FALSE;
 
   /* Initialize various other things in the terp. */
   init_operands(); 
+#ifdef DECODE_CACHE
+  init_decode_cache();
+#endif /* DECODE_CACHE */
+#ifdef JIT_COMPILER
+  init_jit();
+#endif /* JIT_COMPILER */
+#ifdef PRECOMPILED_STORY
+  init_aot();
+#endif /* PRECOMPILED_STORY */
+#ifdef CALL_CACHE
+  init_call_cache();
+#endif /* CALL_CACHE */
   init_accel();
   if (!init_serial()) {
     finalize_vm();
@@ -137,14 +165,31 @@ void finalize_vm()
   stream_set_table(0);
 
   if (memmap) {
-    glulx_free(memmap);
+    free_memmap(memmap, endmem);
     memmap = NULL;
   }
   if (stack) {
+#ifdef RESERVE_MEMORY
+    glulx_lazy_free(stack, stacksize);
+#else /* RESERVE_MEMORY */
     glulx_free(stack);
+#endif /* RESERVE_MEMORY */
     stack = NULL;
   }
 
+#ifdef CALL_CACHE
+  final_call_cache();
+#endif /* CALL_CACHE */
+#ifdef PRECOMPILED_STORY
+  final_aot();
+#endif /* PRECOMPILED_STORY */
+#ifdef JIT_COMPILER
+  final_jit();
+#endif /* JIT_COMPILER */
+#ifdef DECODE_CACHE
+  final_decode_cache();
+#endif /* DECODE_CACHE */
+
   final_serial();
 }
 
@@ -155,7 +200,7 @@ void finalize_vm()
 */
 void vm_restart()
 {
-  glui32 lx;
+  glui32 lx, maplen;
   int res;
   int bufpos;
   char buf[0x100];
@@ -168,29 +213,68 @@ void vm_restart()
   if (lx)
     fatal_error("Memory could not be reset to its original size.");
 
-  /* Load in all of main memory. We do this in 256-byte chunks, because
-     why rely on OS stream buffering? */
-  glk_stream_set_position(gamefile, gamefile_start, seekmode_Start);
-  bufpos = 0x100;
+  /* The game can't have changed ROM, so if it's already loaded and
+     serial.c has the original RAM, we just copy that back in. */
+  if (!(romloaded && reset_ram_from_cache())) {
+
+    /* If we can, map in the game file. (But only below the protected
+       range, if there is one, since that must be left alone.) */
+    maplen = 0;
+#ifdef MAP_GAME_FILE
+    maplen = endgamefile;
+    if (protectstart < protectend && protectstart < maplen)
+      maplen = protectstart;
+    maplen = glulx_map_game(memmap, maplen);
+#endif /* MAP_GAME_FILE */
+
+    /* Load in all of main memory (or the rest of it). We do this in
+       256-byte chunks, because why rely on OS stream buffering? (The
+       mapped part may end partway through a chunk. We skip over those
+       bytes, since writing them would unshare their page.) */
+    glk_stream_set_position(gamefile, gamefile_start+(maplen & ~0xFF),
+      seekmode_Start);
+    bufpos = 0x100;
+
+    for (lx=(maplen & ~0xFF); lx<endgamefile; lx++) {
+      if (bufpos >= 0x100) {
+        int count = glk_get_buffer_stream(gamefile, buf, 0x100);
+        if (count != 0x100) {
+          fatal_error("The game file ended unexpectedly.");
+        }
+        bufpos = 0;
+      }
 
-  for (lx=0; lx<endgamefile; lx++) {
-    if (bufpos >= 0x100) {
-      int count = glk_get_buffer_stream(gamefile, buf, 0x100);
-      if (count != 0x100) {
-        fatal_error("The game file ended unexpectedly.");
+      res = buf[bufpos++];
+      if (lx < maplen)
+        continue;
+      if (lx >= protectstart && lx < protectend)
+        continue;
+      memmap[lx] = res;
+    }
+    /* Zero the rest of RAM, again leaving the protected range alone.
+       (reset_ram_from_cache() does the same, so the two paths agree.) */
+    lx = endgamefile;
+    while (lx < origendmem) {
+      glui32 end = origendmem;
+      if (protectstart < protectend) {
+        if (lx >= protectstart && lx < protectend) {
+          lx = protectend;
+          continue;
+        }
+        if (lx < protectstart && protectstart < end)
+          end = protectstart;
       }
-      bufpos = 0;
+      memset(memmap+lx, 0, end-lx);
+      lx = end;
     }
 
-    res = buf[bufpos++];
-    if (lx >= protectstart && lx < protectend)
-      continue;
-    memmap[lx] = res;
-  }
-  for (lx=endgamefile; lx<origendmem; lx++) {
-    memmap[lx] = 0;
+    romloaded = TRUE;
   }
 
+  /* RAM has been reloaded behind the WatchW() checks. */
+  if (watchlen)
+    stream_table_changed();
+
   /* Reset all the registers */
   stackptr = 0;
   frameptr = 0;
@@ -218,7 +302,6 @@ void vm_restart()
 */
 glui32 change_memsize(glui32 newlen, int internal)
 {
-  long lx;
   unsigned char *newmemmap;
 
   if (newlen == endmem)
@@ -237,26 +320,72 @@ glui32 change_memsize(glui32 newlen, int internal)
   if (newlen & 0xFF)
     fatal_error("Can only resize Glulx memory space to a 256-byte boundary.");
   
-  newmemmap = (unsigned char *)glulx_realloc(memmap, newlen);
+  newmemmap = realloc_memmap(memmap, endmem, newlen);
   if (!newmemmap) {
     /* The old block is still in place, unchanged. */
     return 1;
   }
   memmap = newmemmap;
 
+#ifndef RESERVE_MEMORY
+  /* (A reserved block is always zero past its end, so it needs no
+     clearing.) */
   if (newlen > endmem) {
-    for (lx=endmem; lx<newlen; lx++) {
-      memmap[lx] = 0;
-    }
+    memset(memmap+endmem, 0, newlen-endmem);
   }
+#endif /* RESERVE_MEMORY */
 
   endmem = newlen;
 
+  /* A string table that the cache was built from may have lost nodes
+     (or gained ones that were out of range). */
+  if (watchlen)
+    stream_table_changed();
+
   return 0;
 
 #endif /* FIXED_MEMSIZE */
 }
 
+/* alloc_memmap(), realloc_memmap(), free_memmap():
+   Allocate, resize, and free the main-memory block, using whichever
+   allocator the compile options call for. The lengths are the current
+   size of the block (realloc_memmap() also takes the new size).
+*/
+static unsigned char *alloc_memmap(glui32 len)
+{
+#if defined(GUARD_MEMORY_ACCESS)
+  return glulx_guarded_malloc(len);
+#elif defined(RESERVE_MEMORY)
+  return glulx_reserved_malloc(len);
+#else
+  return (unsigned char *)glulx_malloc(len);
+#endif
+}
+
+static unsigned char *realloc_memmap(unsigned char *ptr, glui32 oldlen,
+  glui32 len)
+{
+#if defined(GUARD_MEMORY_ACCESS)
+  return glulx_guarded_realloc(ptr, oldlen, len);
+#elif defined(RESERVE_MEMORY)
+  return glulx_reserved_realloc(ptr, oldlen, len);
+#else
+  return (unsigned char *)glulx_realloc(ptr, len);
+#endif
+}
+
+static void free_memmap(unsigned char *ptr, glui32 len)
+{
+#if defined(GUARD_MEMORY_ACCESS)
+  glulx_guarded_free(ptr);
+#elif defined(RESERVE_MEMORY)
+  glulx_reserved_free(ptr);
+#else
+  glulx_free(ptr);
+#endif
+}
+
 /* pop_arguments():
    If addr is 0, pop N arguments off the stack, and put them in an array. 
    If non-0, take N arguments from that main memory address instead.